@@ -1,69 +1,318 @@
 #ifndef LRUCACHE_H
 #define LRUCACHE_H
 
+#include <QFuture>
+#include <QFutureInterface>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+
+#include "lruspillfile.h"
 #include "orderedmap.h"
 
+/* All calls lock the cache, so it can be shared between threads. Values
+ * computed by getOrCompute() are loaded on a thread pool of the cache's own,
+ * which the destructor waits for.
+ *
+ * With a spill file set, entries evicted from memory move to disk instead of
+ * being dropped, and a hit on disk moves the entry back into memory. The
+ * capacity then only bounds the entries in memory.
+ */
 template <typename Key, typename T>
 class LruCache
 {
 public:
-    LruCache() {}
-    LruCache(int capacity) : cap_(capacity) {}
+    LruCache() : nextLoad_(0), spill_(0) {
+        OM_STAT(evictions_ = 0);
+    }
+    LruCache(int capacity) : cap_(capacity), nextLoad_(0), spill_(0) {
+        OM_STAT(evictions_ = 0);
+    }
+
+    ~LruCache() {
+        pool_.waitForDone();
+        delete spill_;
+    }
+
+#ifdef ORDEREDMAP_ENABLE_STATS
+    OrderedMapStats stats() const {
+        QMutexLocker locker(&lock_);
+        OrderedMapStats snapshot = entries.stats();
+        snapshot.evictions = evictions_;
+        return snapshot;
+    }
+
+    void resetStats() {
+        QMutexLocker locker(&lock_);
+        entries.resetStats();
+        evictions_ = 0;
+    }
+#endif
 
     int capacity() const {
+        QMutexLocker locker(&lock_);
         return cap_;
     }
 
     void setCapacity(int capacity) {
+        QMutexLocker locker(&lock_);
         cap_ = capacity;
         if (capacity < entries.size()) {
-            typename OrderedMap<Key, T>::Iterator it = entries.begin();
-            while (entries.size() > capacity) {
-                it = entries.erase(it);
+            if (spill_) {
+                typename OrderedMap<Key, T>::Iterator it = entries.begin();
+                for (int i = capacity; i < entries.size(); ++i, ++it) {
+                    spill(it.key(), it.value());
+                }
             }
+            int evicted = entries.truncateFront(entries.size() - capacity);
+            OM_STAT(evictions_ += evicted);
+            Q_UNUSED(evicted);
+        }
+    }
+
+    /* Moves evicted entries to fileName, which is emptied, from now on. Key
+     * and T need QDataStream operators. Call it before the cache is shared
+     * between threads.
+     */
+    bool setSpillFile(const QString &fileName) {
+        pool_.waitForDone();
+        QMutexLocker locker(&lock_);
+        delete spill_;
+        LruSpillFile<Key, T> *file = new LruSpillFile<Key, T>(fileName);
+        if (!file->open()) {
+            delete file;
+            spill_ = 0;
+            return false;
         }
+        spill_ = file;
+        return true;
     }
 
     void clear() {
+        QMutexLocker locker(&lock_);
         entries.clear();
+        loading_.clear();
+        if (spill_) {
+            spill_->clear();
+        }
     }
 
+    // Entries in memory, without those spilled to disk
     int size() const {
+        QMutexLocker locker(&lock_);
         return entries.size();
     }
 
+    int spilledCount() const {
+        QMutexLocker locker(&lock_);
+        return spill_ ? spill_->count() : 0;
+    }
+
     bool contains(Key key) const {
-        return entries.contains(key);
+        QMutexLocker locker(&lock_);
+        return entries.contains(key) || (spill_ && spill_->contains(key));
     }
 
     void insert(Key key, T value) {
-        entries.insert(key, value);
+        QMutexLocker locker(&lock_);
+        loading_.remove(key);
+        insertEntry(key, value);
+    }
 
-        if (entries.size() > cap_) {
-            entries.erase(entries.begin());
+    T value(Key key) {
+        T value;
+        return lookup(key, value) ? value : T();
+    }
+
+    // Like value(), but tells a miss from a default-constructed value
+    bool lookup(const Key &key, T &value) {
+        QMutexLocker locker(&lock_);
+        typename OrderedMap<Key, T>::Iterator it = entries.find(key);
+        if (it == entries.end()) {
+            return unspill(key, value);
         }
+        value = it.value();
+        // Refresh entry
+        entries.insert(key, value);
+        return true;
     }
 
-    T value(Key key) {
-        T value = entries.value(key);
-        if (entries.contains(key)) {
-            // Refresh entry
+    /* Returns the cached value for key, refreshing it, as a finished future.
+     * On a miss, calls loader(key, value) on the cache's thread pool, and
+     * caches value if it returns true. Misses for a key that is already being
+     * loaded share that load instead of starting another. A failed load is
+     * not cached: its future finishes canceled, without a result, and the
+     * next miss tries again.
+     *
+     * insert(), remove() and clear() supersede loads in flight for the keys
+     * they touch: those still finish for whoever waits on them, but their
+     * values are not cached, and later misses start a new load.
+     */
+    template <typename Loader>
+    QFuture<T> getOrCompute(Key key, Loader loader) {
+        QMutexLocker locker(&lock_);
+        typename OrderedMap<Key, T>::Iterator it = entries.find(key);
+        if (it != entries.end()) {
+            T value = it.value();
             entries.insert(key, value);
+
+            QFutureInterface<T> ready;
+            ready.reportStarted();
+            ready.reportResult(value);
+            ready.reportFinished();
+            return ready.future();
+        }
+        T spilled;
+        if (unspill(key, spilled)) {
+            QFutureInterface<T> ready;
+            ready.reportStarted();
+            ready.reportResult(spilled);
+            ready.reportFinished();
+            return ready.future();
+        }
+
+        typename OrderedMap<Key, InFlight>::Iterator inFlight = loading_.find(key);
+        if (inFlight != loading_.end()) {
+            return inFlight.value().promise.future();
         }
-        return value;
+
+        InFlight load;
+        load.promise.reportStarted();
+        load.id = nextLoad_++;
+        loading_.insert(key, load);
+        pool_.start(new Load<Loader>(this, key, load, loader));
+        return load.promise.future();
     }
 
     void remove(Key key) {
+        QMutexLocker locker(&lock_);
         entries.remove(key);
+        loading_.remove(key);
+        if (spill_) {
+            spill_->remove(key);
+        }
     }
 
+    // Keys in memory, least recently used first
     QList<Key> keys() const {
+        QMutexLocker locker(&lock_);
         return entries.keys();
     }
 
 private:
+    Q_DISABLE_COPY(LruCache)
+
+    // A load in flight, until it finishes or is superseded
+    struct InFlight
+    {
+        QFutureInterface<T> promise;
+        quint64 id;
+    };
+
+    template <typename Loader>
+    class Load : public QRunnable
+    {
+    public:
+        Load(LruCache *cache, const Key &key, const InFlight &load, const Loader &loader) :
+            cache(cache), key(key), load(load), loader(loader) {}
+
+        void run() {
+            T value;
+            bool loaded = loader(key, value);
+            cache->finishLoad(key, load, loaded ? &value : 0);
+        }
+
+    private:
+        LruCache *cache;
+        Key key;
+        InFlight load;
+        Loader loader;
+    };
+
+    class Compaction : public QRunnable
+    {
+    public:
+        explicit Compaction(LruCache *cache) : cache(cache) {}
+
+        void run() {
+            cache->spill_->compact(&cache->lock_);
+        }
+
+    private:
+        LruCache *cache;
+    };
+
+    /* Caches a loaded value, unless the load was superseded, then wakes
+     * everyone waiting for it
+     */
+    void finishLoad(const Key &key, InFlight load, const T *value) {
+        {
+            QMutexLocker locker(&lock_);
+            typename OrderedMap<Key, InFlight>::Iterator current = loading_.find(key);
+            if (current != loading_.end() && current.value().id == load.id) {
+                loading_.erase(current);
+                if (value) {
+                    insertEntry(key, *value);
+                }
+            }
+        }
+
+        if (value) {
+            load.promise.reportResult(*value);
+        } else {
+            load.promise.reportCanceled();
+        }
+        load.promise.reportFinished();
+    }
+
+    void insertEntry(const Key &key, const T &value) {
+        entries.insert(key, value);
+        if (spill_) {
+            spill_->remove(key);
+        }
+
+        if (entries.size() > cap_) {
+            typename OrderedMap<Key, T>::Iterator oldest = entries.begin();
+            if (spill_) {
+                spill(oldest.key(), oldest.value());
+            }
+            entries.erase(oldest);
+            OM_STAT(++evictions_);
+        }
+    }
+
+    // An entry that cannot be written out is dropped, as without a spill file
+    void spill(const Key &key, const T &value) {
+        spill_->store(key, value);
+        if (spill_->beginCompaction()) {
+            pool_.start(new Compaction(this));
+        }
+    }
+
+    // Moves a spilled entry back into memory
+    bool unspill(const Key &key, T &value) {
+        if (!spill_ || !spill_->take(key, value)) {
+            return false;
+        }
+        if (spill_->beginCompaction()) {
+            pool_.start(new Compaction(this));
+        }
+        insertEntry(key, value);
+        return true;
+    }
+
     int cap_;
     OrderedMap<Key, T> entries;
+    // Loads in flight, each shared by all misses for its key
+    OrderedMap<Key, InFlight> loading_;
+    quint64 nextLoad_;
+    LruSpillTier<Key, T> *spill_;
+    mutable QMutex lock_;
+#ifdef ORDEREDMAP_ENABLE_STATS
+    quint64 evictions_;
+#endif
+    // Runs loads and compactions
+    QThreadPool pool_;
 };
 
 #endif // LRUCACHE_H
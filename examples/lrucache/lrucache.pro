@@ -2,7 +2,13 @@ QT -= gui
 SOURCES = \
     main.cpp
 
+# Qt 6 needs C++17
+greaterThan(QT_MAJOR_VERSION, 5) {
+CONFIG += c++17
+}
+
 include (../../src/src.pri)
 
 HEADERS += \
-    lrucache.h
+    lrucache.h \
+    lruspillfile.h
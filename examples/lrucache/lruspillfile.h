@@ -0,0 +1,260 @@
+#ifndef LRUSPILLFILE_H
+#define LRUSPILLFILE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QFile>
+#include <QMutex>
+#include <QString>
+
+#include "orderedmap.h"
+
+/* A second tier that LruCache moves evicted entries to, and takes them back
+ * from on a hit. LruCache only calls it with its lock held, except for
+ * compact(), which takes the lock itself while it needs it.
+ *
+ * Only LruSpillFile, which implements it, streams keys and values, so caches
+ * without a second tier need no QDataStream operators for them.
+ */
+template <typename Key, typename T>
+class LruSpillTier
+{
+public:
+    virtual ~LruSpillTier() {}
+
+    virtual bool store(const Key &key, const T &value) = 0;
+
+    virtual bool take(const Key &key, T &value) = 0;
+
+    virtual bool contains(const Key &key) const = 0;
+
+    virtual void remove(const Key &key) = 0;
+
+    virtual void clear() = 0;
+
+    virtual int count() const = 0;
+
+    // Returns true, once, when compact() should be run
+    virtual bool beginCompaction() = 0;
+
+    virtual void compact(QMutex *lock) = 0;
+};
+
+/* Keeps spilled entries in an append-only file, one QDataStream record per
+ * entry, with only their offsets in memory, in an OrderedMap that keeps them
+ * oldest first. Taking an entry back or replacing it leaves its record dead
+ * in the file.
+ *
+ * Once dead records take up more than live ones, the file is compacted on a
+ * background thread: the live records are copied to a new file without
+ * holding the cache's lock, then the records spilled meanwhile are copied
+ * under it, and the new file replaces the old. The file is removed when the
+ * tier is destroyed.
+ */
+template <typename Key, typename T>
+class LruSpillFile : public LruSpillTier<Key, T>
+{
+public:
+    explicit LruSpillFile(const QString &fileName) :
+        file(fileName), end(0), liveBytes(0), deadBytes(0), generation(0), compacting(false) {}
+
+    ~LruSpillFile() {
+        file.remove();
+    }
+
+    // Starts with an empty file
+    bool open() {
+        return file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+    }
+
+    bool store(const Key &key, const T &value) {
+        remove(key);
+
+        QByteArray bytes;
+        {
+            QDataStream out(&bytes, QIODevice::WriteOnly);
+            out << key << value;
+        }
+        if (!file.seek(end) || file.write(bytes) != bytes.size()) {
+            return false;
+        }
+
+        Record record = { end, int(bytes.size()) };
+        records.insert(key, record);
+        end += record.size;
+        liveBytes += record.size;
+        return true;
+    }
+
+    bool take(const Key &key, T &value) {
+        typename OrderedMap<Key, Record>::iterator it = records.find(key);
+        if (it == records.end()) {
+            return false;
+        }
+        Record record = it.value();
+        records.erase(it);
+        liveBytes -= record.size;
+        deadBytes += record.size;
+
+        if (!file.seek(record.offset)) {
+            return false;
+        }
+        QByteArray bytes = file.read(record.size);
+        if (bytes.size() != record.size) {
+            return false;
+        }
+        QDataStream in(bytes);
+        Key stored;
+        in >> stored >> value;
+        return in.status() == QDataStream::Ok;
+    }
+
+    bool contains(const Key &key) const {
+        return records.contains(key);
+    }
+
+    void remove(const Key &key) {
+        typename OrderedMap<Key, Record>::iterator it = records.find(key);
+        if (it != records.end()) {
+            liveBytes -= it.value().size;
+            deadBytes += it.value().size;
+            records.erase(it);
+        }
+    }
+
+    void clear() {
+        records.clear();
+        file.resize(0);
+        end = 0;
+        liveBytes = 0;
+        deadBytes = 0;
+        // Any compaction running now is of records that are gone
+        ++generation;
+    }
+
+    int count() const {
+        return records.size();
+    }
+
+    bool beginCompaction() {
+        if (compacting || deadBytes < CompactAfterBytes || deadBytes <= liveBytes) {
+            return false;
+        }
+        compacting = true;
+        return true;
+    }
+
+    void compact(QMutex *lock);
+
+private:
+    Q_DISABLE_COPY(LruSpillFile)
+
+    enum { CompactAfterBytes = 1 << 20 };
+
+    struct Record
+    {
+        qint64 offset;
+        int size;
+    };
+
+    // Appends the record to target, if it can be read back from source
+    static bool copyRecord(QFile &source, QFile &target, Record &record, qint64 &targetEnd) {
+        if (!source.seek(record.offset)) {
+            return false;
+        }
+        QByteArray bytes = source.read(record.size);
+        if (bytes.size() != record.size || target.write(bytes) != record.size) {
+            return false;
+        }
+        record.offset = targetEnd;
+        targetEnd += record.size;
+        return true;
+    }
+
+    QFile file;
+    // Spilled entries, oldest first
+    OrderedMap<Key, Record> records;
+    qint64 end;
+    qint64 liveBytes;
+    qint64 deadBytes;
+    int generation;
+    bool compacting;
+};
+
+template <typename Key, typename T>
+void LruSpillFile<Key, T>::compact(QMutex *lock)
+{
+    OrderedMap<Key, Record> snapshot;
+    qint64 snapshotEnd;
+    int snapshotGeneration;
+    QString fileName;
+    {
+        QMutexLocker locker(lock);
+        file.flush();
+        fileName = file.fileName();
+        snapshot = records;
+        snapshotEnd = end;
+        snapshotGeneration = generation;
+    }
+
+    /* Records below snapshotEnd are never written again, so they can be read
+     * unlocked. The snapshot is updated with where they were copied to.
+     */
+    QFile source(fileName);
+    QFile target(fileName + QString(".compact"));
+    bool ok = source.open(QIODevice::ReadOnly)
+              && target.open(QIODevice::ReadWrite | QIODevice::Truncate);
+    qint64 targetEnd = 0;
+    for (typename OrderedMap<Key, Record>::iterator it = snapshot.begin(); ok && it != snapshot.end(); ++it) {
+        ok = copyRecord(source, target, it.value(), targetEnd);
+    }
+    source.close();
+
+    QMutexLocker locker(lock);
+    compacting = false;
+    if (!ok || generation != snapshotGeneration) {
+        target.remove();
+        return;
+    }
+
+    /* A record below snapshotEnd is still the one in the snapshot, as a key
+     * spilled again gets a new record; later ones are copied now.
+     */
+    OrderedMap<Key, Record> compacted;
+    compacted.reserve(records.size());
+    qint64 compactedBytes = 0;
+    for (typename OrderedMap<Key, Record>::iterator it = records.begin(); ok && it != records.end(); ++it) {
+        Record record = it.value();
+        if (record.offset < snapshotEnd) {
+            record.offset = snapshot.value(it.key()).offset;
+        } else {
+            ok = copyRecord(file, target, record, targetEnd);
+        }
+        compacted.insert(it.key(), record);
+        compactedBytes += record.size;
+    }
+    if (!ok || !target.flush()) {
+        target.remove();
+        return;
+    }
+
+    target.close();
+    file.close();
+    if (!QFile::remove(fileName) || !QFile::rename(target.fileName(), fileName)
+        || !file.open(QIODevice::ReadWrite)) {
+        // The spilled entries are lost, which for a cache is only a few misses
+        records.clear();
+        file.open(QIODevice::ReadWrite | QIODevice::Truncate);
+        end = 0;
+        liveBytes = 0;
+        deadBytes = 0;
+        return;
+    }
+
+    records = compacted;
+    end = targetEnd;
+    liveBytes = compactedBytes;
+    deadBytes = 0;
+}
+
+#endif // LRUSPILLFILE_H
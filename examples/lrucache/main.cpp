@@ -1,14 +1,25 @@
+#include <QDir>
 #include <QString>
 #include <QDebug>
 
 #include "lrucache.h"
 
+// Stands in for a slow lookup, eg. in a database. Fails for negative keys
+static bool loadNumber(const int &key, QString &value)
+{
+    if (key < 0) {
+        return false;
+    }
+    value = QString::number(key);
+    return true;
+}
+
 int main(int argc, char **argv)
 {
     Q_UNUSED(argc);
     Q_UNUSED(argv);
 
-    LruCache<int, QString> lru = LruCache<int, QString>(5);
+    LruCache<int, QString> lru(5);
 
     lru.insert(1, "one");
     lru.insert(2, "two");
@@ -79,4 +90,27 @@ int main(int argc, char **argv)
             deb << key;
         }
     }
+
+    // Two misses for the same key share one load
+    QFuture<QString> first = lru.getOrCompute(8, loadNumber);
+    QFuture<QString> second = lru.getOrCompute(8, loadNumber);
+    qDebug() << "Loaded 8 as" << first.result() << "and" << second.result();
+    qDebug() << "LRU cache contains 8?" << lru.contains(8);
+
+    // A failed load is not cached
+    QFuture<QString> failed = lru.getOrCompute(-1, loadNumber);
+    failed.waitForFinished();
+    qDebug() << "Loading -1 failed?" << failed.isCanceled();
+    qDebug() << "LRU cache contains -1?" << lru.contains(-1);
+
+    // With a spill file, evicted entries move to disk instead of being lost
+    LruCache<int, QString> spilling(2);
+    if (spilling.setSpillFile(QDir::temp().filePath("lrucache-example.spill"))) {
+        spilling.insert(1, "one");
+        spilling.insert(2, "two");
+        spilling.insert(3, "three");
+        qDebug() << "Entries in memory" << spilling.size() << "and on disk" << spilling.spilledCount();
+        qDebug() << "Value for spilled 1 is" << spilling.value(1);
+        qDebug() << "Entries on disk after reading 1 back" << spilling.spilledCount();
+    }
 }
@@ -0,0 +1,146 @@
+#ifndef CONCURRENTORDEREDMAP_H
+#define CONCURRENTORDEREDMAP_H
+
+#include <QtGlobal>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QMutex>
+#include <QThread>
+
+#include "orderedmap.h"
+
+/* An OrderedMap shared between one or more writers and any number of reader
+ * threads, without readers ever waiting for a writer.
+ *
+ * Writers never modify the map readers see. They build the next version
+ * and publish it by swapping a pointer. snapshot() returns the current
+ * version as an ordinary OrderedMap, which is an implicitly shared copy, so
+ * taking it costs a few atomic operations however large the map is, and the
+ * snapshot stays valid and unchanged for as long as the reader keeps it,
+ * across any number of later versions. Iterating it needs no locking.
+ *
+ * Only the small holder of the current version is reclaimed explicitly: a
+ * writer that replaced it waits for a grace period, until no reader can
+ * still be copying from it, before deleting it. The map data itself is
+ * freed by implicit sharing when the last snapshot of it goes away.
+ *
+ * A version is an OrderedMap, so the first change after publishing copies
+ * the entries. Batch changes into one update() where possible.
+ */
+template <typename Key, typename Value>
+class ConcurrentOrderedMap
+{
+public:
+    ConcurrentOrderedMap();
+
+    explicit ConcurrentOrderedMap(const OrderedMap<Key, Value> &map);
+
+    ~ConcurrentOrderedMap();
+
+    void publish(const OrderedMap<Key, Value> &map);
+
+    OrderedMap<Key, Value> snapshot() const;
+
+    template <typename Function>
+    void update(Function function);
+
+private:
+    Q_DISABLE_COPY(ConcurrentOrderedMap)
+
+    struct Version
+    {
+        explicit Version(const OrderedMap<Key, Value> &map) : map(map) {}
+
+        const OrderedMap<Key, Value> map;
+    };
+
+    void replace(Version *next);
+
+    // Mutable, as snapshot() reads it with a read-modify-write
+    mutable QAtomicPointer<Version> current;
+    // Readers announce themselves in the counter of the current epoch's parity
+    QAtomicInt epoch;
+    mutable QAtomicInt readers[2];
+    QMutex writeLock;
+};
+
+template <typename Key, typename Value>
+ConcurrentOrderedMap<Key, Value>::ConcurrentOrderedMap() :
+    current(new Version(OrderedMap<Key, Value>())), epoch(0)
+{
+}
+
+template <typename Key, typename Value>
+ConcurrentOrderedMap<Key, Value>::ConcurrentOrderedMap(const OrderedMap<Key, Value> &map) :
+    current(new Version(map)), epoch(0)
+{
+}
+
+// No reader may be inside snapshot() any more
+template <typename Key, typename Value>
+ConcurrentOrderedMap<Key, Value>::~ConcurrentOrderedMap()
+{
+    delete current.loadAcquire();
+}
+
+// Makes map the version returned by snapshot() from now on
+template <typename Key, typename Value>
+void ConcurrentOrderedMap<Key, Value>::publish(const OrderedMap<Key, Value> &map)
+{
+    QMutexLocker locker(&writeLock);
+    replace(new Version(map));
+}
+
+/* Lock-free: a reader only registers in an epoch counter for as long as it
+ * takes to copy the current version.
+ */
+template <typename Key, typename Value>
+OrderedMap<Key, Value> ConcurrentOrderedMap<Key, Value>::snapshot() const
+{
+    QAtomicInt &counter = readers[epoch.loadAcquire() & 1];
+
+    /* Read-modify-writes on both sides, as plain acquire loads could let
+     * this reader and the writer each miss the other's write. These always
+     * read the latest value, so the writer either sees this reader or we see
+     * its version.
+     */
+    counter.fetchAndAddOrdered(1);
+    OrderedMap<Key, Value> map = current.fetchAndAddOrdered(0)->map;
+    counter.fetchAndAddRelease(-1);
+    return map;
+}
+
+/* Calls function with a copy of the current version to modify, then
+ * publishes the result. Writers are serialized, so no update is lost.
+ */
+template <typename Key, typename Value>
+template <typename Function>
+void ConcurrentOrderedMap<Key, Value>::update(Function function)
+{
+    QMutexLocker locker(&writeLock);
+    OrderedMap<Key, Value> next = current.loadAcquire()->map;
+    function(next);
+    replace(new Version(next));
+}
+
+/* Publishes next, then retires the previous version once every reader that
+ * could have loaded it is gone. A reader may have read the epoch just before
+ * the last flip, so the epoch is flipped twice and each old parity drained
+ * in turn; readers arriving meanwhile register in the other counter, so the
+ * wait cannot be starved.
+ */
+template <typename Key, typename Value>
+void ConcurrentOrderedMap<Key, Value>::replace(Version *next)
+{
+    Version *previous = current.fetchAndStoreOrdered(next);
+    for (int flip = 0; flip < 2; ++flip) {
+        int parity = epoch.fetchAndAddOrdered(1) & 1;
+        // A read-modify-write, for the same reason as in snapshot()
+        while (readers[parity].fetchAndAddOrdered(0) != 0) {
+            QThread::yieldCurrentThread();
+        }
+    }
+    delete previous;
+}
+
+#endif // CONCURRENTORDEREDMAP_H
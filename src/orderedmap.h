@@ -2,15 +2,104 @@
 #define ORDEREDMAP_H
 
 #include <QtGlobal>
+#include <QDataStream>
 #include <QHash>
-#include <QLinkedList>
 #include <QList>
-#include <QPair>
+#include <QVector>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
 
 #ifdef Q_COMPILER_INITIALIZER_LISTS
 #include <initializer_list>
 #endif
 
+/* Operation statistics are compiled in only when ORDEREDMAP_ENABLE_STATS is
+ * defined, otherwise OM_STAT() expands to nothing and the counters do not
+ * exist at all.
+ */
+#ifdef ORDEREDMAP_ENABLE_STATS
+#define OM_STAT(statement) statement
+#else
+#define OM_STAT(statement)
+#endif
+
+// Hints the CPU to start loading address into cache, where supported
+#ifdef Q_CC_GNU
+#define OM_PREFETCH(address) __builtin_prefetch(address)
+#else
+#define OM_PREFETCH(address)
+#endif
+
+#ifdef ORDEREDMAP_ENABLE_STATS
+struct OrderedMapStats
+{
+    OrderedMapStats() :
+        hits(0), misses(0), inserts(0), overwrites(0), evictions(0),
+        rehashes(0), relinks(0), maxProbeLength(0), averageChainLength(0) {}
+
+    quint64 hits;           // lookups that found the key
+    quint64 misses;         // lookups that did not find the key
+    quint64 inserts;        // new keys added
+    quint64 overwrites;     // values replaced for existing keys
+    quint64 evictions;      // entries dropped by a cache built on the map
+    quint64 rehashes;       // times the hash table grew
+    quint64 relinks;        // keys moved to the end of the insertion order
+    int maxProbeLength;     // longest lookup sequence in the hash table
+    qreal averageChainLength;
+};
+#endif
+
+template <typename Key, typename Value> class OrderedMapJournal;
+template <typename Key> class OrderedSet;
+template <typename Key, typename Value> struct OrderedMapDiff;
+struct OrderedMapConcurrent;
+
+/* A slot of OrderedMap's index, an open-addressed table with linear probing.
+ * It holds the hash of a key and its node position + 1, 0 marking a free
+ * slot. The index only depends on keys, so maps with the same keys in the
+ * same places can share it whatever their value types.
+ */
+struct OrderedMapIndexSlot
+{
+    uint hash;
+    int pos;
+};
+
+/* Only iterators over std::pair-like elements have a Type, so the range
+ * insert() never competes with insert(key, value) for other arguments.
+ */
+template <typename Iterator,
+          typename First = typename std::iterator_traits<Iterator>::value_type::first_type>
+struct OrderedMapPairIterator
+{
+    typedef void Type;
+};
+
+// A begin/end pair, so views can be used with range-based for loops
+template <typename Iterator>
+class OrderedMapRange
+{
+    Iterator first;
+    Iterator last;
+
+public:
+    OrderedMapRange(const Iterator &first, const Iterator &last) :
+        first(first), last(last) {}
+
+    Iterator begin() const
+    {
+        return first;
+    }
+
+    Iterator end() const
+    {
+        return last;
+    }
+};
+
 template <typename Key> inline bool oMHashEqualToKey(const Key &key1, const Key &key2)
 {
     // Key type must provide '==' operator
@@ -29,25 +118,64 @@ template <typename Ptr> inline bool oMHashEqualToKey(const Ptr *key1, const Ptr
     return quintptr(key1) == quintptr(key2);
 }
 
-template <typename Key, typename Value>
-class OrderedMap
+// Hashes keys with the global qHash(), which OrderedMap uses by default
+template <typename Key>
+struct OrderedMapHash
+{
+    uint operator()(const Key &key) const
+    {
+        return qHash(key);
+    }
+};
+
+template <typename Key>
+struct OrderedMapEqual
 {
-    class OMHash;
+    bool operator()(const Key &key1, const Key &key2) const
+    {
+        return oMHashEqualToKey(key1, key2);
+    }
+};
 
-    typedef typename QLinkedList<Key>::iterator QllIterator;
-    typedef typename QLinkedList<Key>::const_iterator QllConstIterator;
-    typedef QPair<Value, QllIterator> OMHashValue;
+/* Hash and Equal are default constructed where needed, so they must not
+ * carry state. Hash must give equal keys equal hashes.
+ */
+template <typename Key, typename Value,
+          typename Hash = OrderedMapHash<Key>, typename Equal = OrderedMapEqual<Key> >
+class OrderedMap
+{
+    /* Entries are kept in a vector, in insertion order. Removing one leaves a
+     * hole behind that iteration skips; holes are compacted away once they
+     * outnumber the live entries. Nodes cache the hash of their key, so
+     * neither compaction nor growing the index has to hash keys again.
+     *
+     * The value comes last, so an empty Value (see OrderedSet) fits in the
+     * padding after live and costs no space.
+     */
+    struct Node
+    {
+        Key key;
+        uint hash;
+        bool live;
+        Value value;
+    };
 
-    typedef typename OMHash::iterator OMHashIterator;
-    typedef typename OMHash::const_iterator OMHashConstIterator;
+    typedef OrderedMapIndexSlot IndexSlot;
 
 public:
 
     class iterator;
     class const_iterator;
+    class key_iterator;
+    class item_iterator;
+    class node_type;
+
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::iterator Iterator;
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::const_iterator ConstIterator;
 
-    typedef typename OrderedMap<Key, Value>::iterator Iterator;
-    typedef typename OrderedMap<Key, Value>::const_iterator ConstIterator;
+    typedef OrderedMapRange<key_iterator> KeyView;
+    typedef OrderedMapRange<const_iterator> ValueView;
+    typedef OrderedMapRange<item_iterator> ItemView;
 
     explicit OrderedMap();
 
@@ -55,12 +183,14 @@ public:
     OrderedMap(std::initializer_list<std::pair<Key,Value> > list);
 #endif
 
-    OrderedMap(const OrderedMap<Key, Value>& other);
+    OrderedMap(const OrderedMap<Key, Value, Hash, Equal>& other);
 
 #if (QT_VERSION >= 0x050200)
-    OrderedMap(OrderedMap<Key, Value>&& other);
+    OrderedMap(OrderedMap<Key, Value, Hash, Equal>&& other);
 #endif
 
+    const Value &at(int i) const;
+
     void clear();
 
     bool contains(const Key &key) const;
@@ -69,33 +199,88 @@ public:
 
     bool empty() const;
 
+    QList<const_iterator> findMany(const QList<Key> &keys) const;
+
+    int indexOf(const Key &key) const;
+
     iterator insert(const Key &key, const Value &value);
 
+    iterator insert(node_type &node);
+
+    template <typename InputIterator>
+    typename OrderedMapPairIterator<InputIterator>::Type insert(InputIterator first, InputIterator last);
+
+    void insert(const OrderedMap<Key, Value, Hash, Equal> &other);
+
     bool isEmpty() const;
 
+    ItemView items() const;
+
+    OrderedMapJournal<Key, Value> *journal() const;
+
+    const Key &keyAt(int i) const;
+
     QList<Key> keys() const;
 
+    KeyView keyView() const;
+
     int remove(const Key &key);
 
+    template <typename Predicate>
+    int removeIf(Predicate pred);
+
+    void reserve(int size);
+
+    void setJournal(OrderedMapJournal<Key, Value> *journal);
+
     int size() const;
 
+    template <typename LessThan>
+    void sort(LessThan lessThan);
+
+    void sortByKey();
+
+    template <typename LessThan>
+    void sortByKey(LessThan lessThan);
+
+    void sortByValue();
+
+    template <typename LessThan>
+    void sortByValue(LessThan lessThan);
+
+    void squeeze();
+
     Value take(const Key &key);
 
+    int truncateFront(int n);
+
     Value value(const Key &key) const;
 
     Value value(const Key &key, const Value &defaultValue) const;
 
     QList<Value> values() const;
 
-    OrderedMap<Key, Value> & operator=(const OrderedMap<Key, Value>& other);
+    QList<Value> valuesFor(const QList<Key> &keys) const;
+
+    OrderedMap<Key, Value, Hash, Equal> &unite(const OrderedMap<Key, Value, Hash, Equal> &other);
+
+    ValueView valueView() const;
+
+    OrderedMap<Key, Value, Hash, Equal> & operator=(const OrderedMap<Key, Value, Hash, Equal>& other);
 
 #if (QT_VERSION >= 0x050200)
-    OrderedMap<Key, Value> & operator=(OrderedMap<Key, Value>&& other);
+    OrderedMap<Key, Value, Hash, Equal> & operator=(OrderedMap<Key, Value, Hash, Equal>&& other);
 #endif
 
-    bool operator==(const OrderedMap<Key, Value> &other) const;
+    bool operator==(const OrderedMap<Key, Value, Hash, Equal> &other) const;
+
+    bool operator!=(const OrderedMap<Key, Value, Hash, Equal> &other) const;
 
-    bool operator!=(const OrderedMap<Key, Value> &other) const;
+#ifdef ORDEREDMAP_ENABLE_STATS
+    OrderedMapStats stats() const;
+
+    void resetStats();
+#endif
 
     Value& operator[](const Key &key);
 
@@ -111,35 +296,47 @@ public:
 
     iterator erase(iterator pos);
 
+    iterator erase(iterator first, iterator last);
+
+    node_type extract(const Key &key);
+
+    node_type extract(iterator pos);
+
     iterator find(const Key& key);
 
     const_iterator find(const Key& key) const;
 
+    iterator splice(OrderedMap<Key, Value, Hash, Equal> &other, iterator pos);
+
     class const_iterator;
 
     class iterator
     {
-        QllIterator qllIter;
-        OMHash *data;
+        OrderedMap *map;
+        int pos;
         friend class const_iterator;
         friend class OrderedMap;
 
     public:
-        iterator() : data(NULL) {}
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef Value *pointer;
+        typedef Value &reference;
 
-        iterator(const QllIterator &qllIter, OMHash *data) :
-            qllIter(qllIter), data(data) {}
+        iterator() : map(NULL), pos(0) {}
+
+        iterator(OrderedMap *map, int pos) :
+            map(map), pos(pos) {}
 
         const Key & key() const
         {
-            return *qllIter;
+            return map->nodes.at(pos).key;
         }
 
         Value & value() const
         {
-            OMHashIterator hit = data->find(*qllIter);
-            OMHashValue &pair = hit.value();
-            return pair.first;
+            return map->nodes[pos].value;
         }
 
         Value & operator*() const
@@ -149,10 +346,7 @@ public:
 
         iterator operator+(int i) const
         {
-            QllIterator q = qllIter;
-            q += i;
-
-            return iterator(q, data);
+            return iterator(map, map->advance(pos, i));
         }
 
         iterator operator-(int i) const
@@ -160,80 +354,109 @@ public:
             return operator +(- i);
         }
 
+        int operator-(const iterator &other) const
+        {
+            return map->rankOf(pos) - map->rankOf(other.pos);
+        }
+
         iterator& operator+=(int i)
         {
-            qllIter += i;
+            pos = map->advance(pos, i);
             return *this;
         }
 
         iterator& operator-=(int i)
         {
-            qllIter -= i;
+            pos = map->advance(pos, -i);
             return *this;
         }
 
         iterator& operator++()
         {
-            ++qllIter;
+            pos = map->nextLive(pos);
             return *this;
         }
 
         iterator operator++(int)
         {
             iterator it = *this;
-            qllIter++;
+            pos = map->nextLive(pos);
             return it;
         }
 
         iterator operator--()
         {
-            --qllIter;
+            pos = map->previousLive(pos);
             return *this;
         }
 
         iterator operator--(int)
         {
             iterator it = *this;
-            qllIter--;
+            pos = map->previousLive(pos);
             return it;
         }
 
         bool operator ==(const iterator &other) const
         {
-            return (qllIter == other.qllIter);
+            return (pos == other.pos);
         }
 
         bool operator !=(const iterator &other) const
         {
-            return (qllIter != other.qllIter);
+            return (pos != other.pos);
+        }
+
+        bool operator <(const iterator &other) const
+        {
+            return (pos < other.pos);
+        }
+
+        bool operator <=(const iterator &other) const
+        {
+            return (pos <= other.pos);
+        }
+
+        bool operator >(const iterator &other) const
+        {
+            return (pos > other.pos);
+        }
+
+        bool operator >=(const iterator &other) const
+        {
+            return (pos >= other.pos);
         }
     };
 
     class const_iterator
     {
 
-        QllConstIterator qllConstIter;
-        const OMHash *data;
+        const OrderedMap *map;
+        int pos;
 
     public:
-        const_iterator() : data(NULL) {}
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef const Value *pointer;
+        typedef const Value &reference;
+
+        const_iterator() : map(NULL), pos(0) {}
 
         const_iterator(const iterator &i) :
-            qllConstIter(i.qllIter), data(i.data) {}
+            map(i.map), pos(i.pos) {}
 
-        const_iterator(const QllConstIterator &qllConstIter, const OMHash* data) :
-            qllConstIter(qllConstIter), data(data) {}
+        const_iterator(const OrderedMap *map, int pos) :
+            map(map), pos(pos) {}
 
         const Key & key() const
         {
-            return *qllConstIter;
+            return map->nodes.at(pos).key;
         }
 
         const Value & value() const
         {
-            OMHashConstIterator hit = data->find(*qllConstIter);
-            const OMHashValue &pair = hit.value();
-            return pair.first;
+            return map->nodes.at(pos).value;
         }
 
         const Value & operator*() const
@@ -243,10 +466,7 @@ public:
 
         const_iterator operator+(int i) const
         {
-            QllConstIterator q = qllConstIter;
-            q += i;
-
-            return const_iterator(q, data);
+            return const_iterator(map, map->advance(pos, i));
         }
 
         const_iterator operator-(int i) const
@@ -254,270 +474,941 @@ public:
             return operator +(- i);
         }
 
+        int operator-(const const_iterator &other) const
+        {
+            return map->rankOf(pos) - map->rankOf(other.pos);
+        }
+
         const_iterator& operator+=(int i)
         {
-            qllConstIter += i;
+            pos = map->advance(pos, i);
             return *this;
         }
 
         const_iterator& operator-=(int i)
         {
-            qllConstIter -= i;
+            pos = map->advance(pos, -i);
             return *this;
         }
 
         const_iterator& operator++()
         {
-            ++qllConstIter;
+            pos = map->nextLive(pos);
             return *this;
         }
 
         const_iterator operator++(int)
         {
             const_iterator it = *this;
-            qllConstIter++;
+            pos = map->nextLive(pos);
             return it;
         }
 
         const_iterator operator--()
         {
-            --qllConstIter;
+            pos = map->previousLive(pos);
             return *this;
         }
 
         const_iterator operator--(int)
         {
             const_iterator it = *this;
-            qllConstIter--;
+            pos = map->previousLive(pos);
             return it;
         }
 
         bool operator ==(const const_iterator &other) const
         {
-            return (qllConstIter == other.qllConstIter);
+            return (pos == other.pos);
         }
 
         bool operator !=(const const_iterator &other) const
         {
-            return (qllConstIter != other.qllConstIter);
+            return (pos != other.pos);
+        }
+
+        bool operator <(const const_iterator &other) const
+        {
+            return (pos < other.pos);
+        }
+
+        bool operator <=(const const_iterator &other) const
+        {
+            return (pos <= other.pos);
+        }
+
+        bool operator >(const const_iterator &other) const
+        {
+            return (pos > other.pos);
+        }
+
+        bool operator >=(const const_iterator &other) const
+        {
+            return (pos >= other.pos);
         }
     };
 
-private:
+    // Iterates over the keys only, in insertion order
+    class key_iterator
+    {
+        const_iterator i;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Key value_type;
+        typedef const Key *pointer;
+        typedef const Key &reference;
+
+        key_iterator() {}
+
+        explicit key_iterator(const const_iterator &i) : i(i) {}
+
+        const Key & operator*() const
+        {
+            return i.key();
+        }
+
+        key_iterator& operator++()
+        {
+            ++i;
+            return *this;
+        }
+
+        key_iterator operator++(int)
+        {
+            key_iterator it = *this;
+            ++i;
+            return it;
+        }
+
+        key_iterator& operator--()
+        {
+            --i;
+            return *this;
+        }
+
+        key_iterator operator--(int)
+        {
+            key_iterator it = *this;
+            --i;
+            return it;
+        }
+
+        bool operator ==(const key_iterator &other) const
+        {
+            return (i == other.i);
+        }
+
+        bool operator !=(const key_iterator &other) const
+        {
+            return (i != other.i);
+        }
+    };
 
-    class OMHash : public QHash<Key, OMHashValue >
+    // Iterates over (key, value) pairs of references, in insertion order
+    class item_iterator
     {
+        const_iterator i;
+
     public:
-        bool operator == (const OMHash &other) const
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef std::pair<const Key &, const Value &> value_type;
+        typedef void pointer;
+        typedef value_type reference;
+
+        item_iterator() {}
+
+        explicit item_iterator(const const_iterator &i) : i(i) {}
+
+        value_type operator*() const
         {
-            if (size() != other.size()) {
-                return false;
-            }
+            return value_type(i.key(), i.value());
+        }
 
-            if (QHash<Key, OMHashValue >::operator ==(other)) {
-                return true;
-            }
+        item_iterator& operator++()
+        {
+            ++i;
+            return *this;
+        }
 
-            typename QHash<Key, OMHashValue >::const_iterator it1 = this->constBegin();
-            typename QHash<Key, OMHashValue >::const_iterator it2 = other.constBegin();
+        item_iterator operator++(int)
+        {
+            item_iterator it = *this;
+            ++i;
+            return it;
+        }
 
-            while(it1 != this->end()) {
-                OMHashValue v1 = it1.value();
-                OMHashValue v2 = it2.value();
+        item_iterator& operator--()
+        {
+            --i;
+            return *this;
+        }
 
-                if ((v1.first != v2.first) || !oMHashEqualToKey<Key>(it1.key(), it2.key())) {
-                    return false;
-                }
-                ++it1;
-                ++it2;
-            }
-            return true;
+        item_iterator operator--(int)
+        {
+            item_iterator it = *this;
+            --i;
+            return it;
+        }
+
+        bool operator ==(const item_iterator &other) const
+        {
+            return (i == other.i);
+        }
+
+        bool operator !=(const item_iterator &other) const
+        {
+            return (i != other.i);
+        }
+    };
+
+
+    /* Owns an entry taken out of a map by extract(). Inserting it into a map
+     * of the same type moves the key and value in, instead of copying them,
+     * and reuses the hash of the key.
+     */
+    class node_type
+    {
+        Key nodeKey;
+        Value nodeValue;
+        uint hash;
+        bool holdsEntry;
+        friend class OrderedMap;
+
+    public:
+        node_type() : hash(0), holdsEntry(false) {}
+
+        bool empty() const
+        {
+            return !holdsEntry;
+        }
+
+        bool isEmpty() const
+        {
+            return !holdsEntry;
+        }
+
+        const Key & key() const
+        {
+            return nodeKey;
+        }
+
+        Value & value()
+        {
+            return nodeValue;
+        }
+
+        const Value & value() const
+        {
+            return nodeValue;
         }
     };
 
 private:
-    void copy(const OrderedMap<Key, Value> &other);
+    template <typename K, typename V, typename H, typename E>
+    friend QDataStream &operator>>(QDataStream &in, OrderedMap<K, V, H, E> &map);
+
+    template <typename K>
+    friend class OrderedSet;
+
+    template <typename K, typename V>
+    friend OrderedMapDiff<K, V> diff(const OrderedMap<K, V> &from, const OrderedMap<K, V> &to);
 
-    OMHash data;
-    QLinkedList<Key> insertOrder;
+    template <typename K, typename V>
+    friend void applyDiff(OrderedMap<K, V> &map, const OrderedMapDiff<K, V> &changes);
+
+    friend struct OrderedMapConcurrent;
+
+    // Number of keys findMany() and valuesFor() have in flight at once
+    enum { LookupBatch = 16 };
+
+    // Up to this many entries, lookups scan the nodes and no index is built
+    enum { LinearScanLimit = 8 };
+
+    struct EveryEntry
+    {
+        bool operator()(const Key &, const Value &) const
+        {
+            return true;
+        }
+    };
+
+    template <typename LessThan>
+    struct KeyOrder
+    {
+        LessThan lessThan;
+
+        bool operator()(const Key &key1, const Value &, const Key &key2, const Value &) const
+        {
+            return lessThan(key1, key2);
+        }
+    };
+
+    template <typename LessThan>
+    struct ValueOrder
+    {
+        LessThan lessThan;
+
+        bool operator()(const Key &, const Value &value1, const Key &, const Value &value2) const
+        {
+            return lessThan(value1, value2);
+        }
+    };
+
+    // Orders node positions by the entries they hold
+    template <typename LessThan>
+    struct PositionOrder
+    {
+        const Node *nodes;
+        LessThan lessThan;
+
+        bool operator()(int pos1, int pos2) const
+        {
+            const Node &node1 = nodes[pos1];
+            const Node &node2 = nodes[pos2];
+            return lessThan(node1.key, node1.value, node2.key, node2.value);
+        }
+    };
+
+    int advance(int pos, int n) const;
+
+    int adoptNode(Key &key, Value &value, uint hash);
+
+    int appendNode(const Key &key, const Value &value, uint hash);
+
+    void buildRanks();
+
+    void compact();
+
+    bool compactIfSparse();
+
+    void copy(const OrderedMap<Key, Value, Hash, Equal> &other);
+
+    void findBatch(const QList<Key> &keys, int first, int count, int *positions) const;
+
+    int findNode(const Key &key, uint hash, int *slot = NULL) const;
+
+    static uint hashOf(const Key &key);
+
+    int homeSlot(uint hash) const;
+
+    static int indexCapacityFor(int count);
+
+    void journalContents();
+
+    bool insertNew(const Key &key, const Value &value);
+
+    static bool keysEqual(const Key &key1, const Key &key2);
+
+    void killNode(int pos);
+
+    void linkAppended(int firstNew);
+
+    void linkSlot(int slot, uint hash, int pos);
+
+    QVector<int> livePositions() const;
+
+    int nextLive(int pos) const;
+
+    void permute(const QVector<int> &order);
+
+    int positionAt(int rank) const;
+
+    int previousLive(int pos) const;
+
+    int rankOf(int pos) const;
+
+    void reindex(int capacity, bool dropDuplicates);
+
+    void removeFromIndex(int slot);
+
+    bool reserveIndex(int count);
+
+    void reset();
+
+    template <typename Predicate>
+    int sweep(int from, int to, Predicate pred);
+
+    int slotOf(int pos) const;
+
+    void unlinkSlot(int slot);
+
+    QVector<Node> nodes;
+    QVector<IndexSlot> index;
+    /* Fenwick tree counting live nodes, so positions and ranks can be mapped
+     * onto each other in O(log n) while there are holes. Built by the change
+     * that makes the first hole and kept up to date until the nodes are
+     * compacted, so positional reads never write and stay safe to make from
+     * several threads at once, as with Qt's containers.
+     */
+    QVector<int> ranks;
+    int liveNodes;
+    int firstLive;
+    int indexShift;
+    OrderedMapJournal<Key, Value> *changeJournal;
+
+#ifdef ORDEREDMAP_ENABLE_STATS
+    // Lookups are const, but still have to be counted
+    mutable OrderedMapStats counters;
+#endif
 };
 
-template <typename Key, typename Value>
-OrderedMap<Key, Value>::OrderedMap() {}
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal>::OrderedMap() :
+    liveNodes(0), firstLive(0), indexShift(32), changeJournal(NULL) {}
 
 #ifdef Q_COMPILER_INITIALIZER_LISTS
-template<typename Key, typename Value>
-OrderedMap<Key, Value>::OrderedMap(std::initializer_list<std::pair<Key, Value> > list)
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal>::OrderedMap(std::initializer_list<std::pair<Key, Value> > list) :
+    liveNodes(0), firstLive(0), indexShift(32), changeJournal(NULL)
 {
     typedef typename std::initializer_list<std::pair<Key,Value> >::const_iterator const_initlist_iter;
+    reserve(int(list.size()));
     for (const_initlist_iter it = list.begin(); it != list.end(); ++it)
         insert(it->first, it->second);
 }
 #endif
 
 
-template <typename Key, typename Value>
-OrderedMap<Key, Value>::OrderedMap(const OrderedMap<Key, Value>& other)
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal>::OrderedMap(const OrderedMap<Key, Value, Hash, Equal>& other) :
+    liveNodes(0), firstLive(0), indexShift(32), changeJournal(NULL)
 {
     copy(other);
 }
 
 #if (QT_VERSION >= 0x050200)
-template <typename Key, typename Value>
-OrderedMap<Key, Value>::OrderedMap(OrderedMap<Key, Value>&& other)
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal>::OrderedMap(OrderedMap<Key, Value, Hash, Equal>&& other) :
+    nodes(std::move(other.nodes)), index(std::move(other.index)), ranks(std::move(other.ranks)),
+    liveNodes(other.liveNodes), firstLive(other.firstLive), indexShift(other.indexShift),
+    changeJournal(NULL)
 {
-    data = std::move(other.data);
-    insertOrder = std::move(other.insertOrder);
+    other.reset();
 }
 #endif
 
-template <typename Key, typename Value>
-void OrderedMap<Key, Value>::clear()
+template <typename Key, typename Value, typename Hash, typename Equal>
+const Value &OrderedMap<Key, Value, Hash, Equal>::at(int i) const
 {
-    data.clear();
-    insertOrder.clear();
+    Q_ASSERT_X(i >= 0 && i < liveNodes, "OrderedMap<Key, Value, Hash, Equal>::at", "index out of range");
+    return nodes.at(positionAt(i)).value;
 }
 
-template <typename Key, typename Value>
-bool OrderedMap<Key, Value>::contains(const Key &key) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::clear()
 {
-    return data.contains(key);
+    reset();
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Clear);
+    }
 }
 
-template <typename Key, typename Value>
-int OrderedMap<Key, Value>::count() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::contains(const Key &key) const
 {
-    return data.count();
+    bool found = findNode(key, hashOf(key)) >= 0;
+    OM_STAT(found ? ++counters.hits : ++counters.misses);
+    return found;
 }
 
-template <typename Key, typename Value>
-bool OrderedMap<Key, Value>::empty() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::count() const
 {
-    return data.empty();
+    return liveNodes;
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::iterator OrderedMap<Key, Value>::insert(const Key &key, const Value &value)
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::empty() const
 {
-    OMHashIterator it = data.find(key);
+    return liveNodes == 0;
+}
 
-    if (it == data.end()) {
-        // New key
-        QllIterator ioIter = insertOrder.insert(insertOrder.end(), key);
-        OMHashValue pair(value, ioIter);
-        data.insert(key, pair);
-        return iterator(ioIter, &data);
+/* Looks up all keys at once, returning an iterator per key, or end() for
+ * keys that are not present. Faster than calling find() for each key on large
+ * maps, see findBatch().
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+QList<typename OrderedMap<Key, Value, Hash, Equal>::const_iterator> OrderedMap<Key, Value, Hash, Equal>::findMany(const QList<Key> &keys) const
+{
+    QList<const_iterator> results;
+    results.reserve(keys.size());
+
+    int positions[LookupBatch];
+    for (int first = 0; first < keys.size(); first += LookupBatch) {
+        int count = qMin(int(LookupBatch), int(keys.size()) - first);
+        findBatch(keys, first, count, positions);
+        for (int i = 0; i < count; ++i) {
+            results.append(const_iterator(this, positions[i] < 0 ? nodes.size() : positions[i]));
+        }
+    }
+    return results;
+}
+
+// Returns the position of key in insertion order, or -1 if it is not present
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::indexOf(const Key &key) const
+{
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
+        return -1;
+    }
+    OM_STAT(++counters.hits);
+    return rankOf(pos);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::insert(const Key &key, const Value &value)
+{
+    uint hash = hashOf(key);
+    int slot;
+    int pos = findNode(key, hash, &slot);
+
+    if (pos < 0) {
+        // New key
+        if (reserveIndex(liveNodes + 1)) {
+            findNode(key, hash, &slot);
+        }
+        pos = appendNode(key, value, hash);
+        linkSlot(slot, hash, pos);
+        OM_STAT(++counters.inserts);
+        if (changeJournal) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Insert, key, value);
+        }
+    } else {
+        OM_STAT(++counters.overwrites);
+        // key may refer to the old node, which is cleared below
+        if (changeJournal) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Overwrite, key, value);
+        }
+        if (pos == nodes.size() - 1) {
+            // Already the last entry, nothing to move
+            nodes[pos].value = value;
+        } else {
+            OM_STAT(++counters.relinks);
+            int oldPos = pos;
+            pos = appendNode(key, value, hash);
+            linkSlot(slot, hash, pos);
+            killNode(oldPos);
+        }
+    }
+
+    // Compacting last, as key and value may refer to nodes that it moves
+    if (compactIfSparse()) {
+        pos = nodes.size() - 1;
+    }
+    return iterator(this, pos);
+}
+
+/* Inserts the entry held by node, with the same effect as insert() of its key
+ * and value, leaving node empty. Returns end() if node is empty.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::insert(node_type &node)
+{
+    if (node.isEmpty()) {
+        return end();
+    }
+
+    int slot;
+    int pos = findNode(node.nodeKey, node.hash, &slot);
+
+    if (pos < 0) {
+        if (changeJournal) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Insert, node.nodeKey, node.nodeValue);
+        }
+        if (reserveIndex(liveNodes + 1)) {
+            findNode(node.nodeKey, node.hash, &slot);
+        }
+        pos = adoptNode(node.nodeKey, node.nodeValue, node.hash);
+        linkSlot(slot, node.hash, pos);
+        OM_STAT(++counters.inserts);
+    } else {
+        if (changeJournal) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Overwrite, node.nodeKey, node.nodeValue);
+        }
+        OM_STAT(++counters.overwrites);
+        OM_STAT(++counters.relinks);
+        int oldPos = pos;
+        pos = adoptNode(node.nodeKey, node.nodeValue, node.hash);
+        linkSlot(slot, node.hash, pos);
+        killNode(oldPos);
+    }
+    node.holdsEntry = false;
+
+    if (compactIfSparse()) {
+        pos = nodes.size() - 1;
+    }
+    return iterator(this, pos);
+}
+
+/* Inserts the (key, value) pairs in [first, last), with the same result as
+ * calling insert() for each of them in turn, but indexing them in one go.
+ * Iterators into this map must not be passed.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename InputIterator>
+typename OrderedMapPairIterator<InputIterator>::Type OrderedMap<Key, Value, Hash, Equal>::insert(InputIterator first, InputIterator last)
+{
+    if (changeJournal) {
+        // Entry by entry, so each one is journaled as an insert or overwrite
+        for (; first != last; ++first) {
+            insert(first->first, first->second);
+        }
+        return;
+    }
+
+    int firstNew = nodes.size();
+    for (; first != last; ++first) {
+        Node node = { first->first, hashOf(first->first), true, first->second };
+        nodes.append(node);
+    }
+    linkAppended(firstNew);
+}
+
+// Inserts all entries of other in its order, overwriting existing keys
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::insert(const OrderedMap<Key, Value, Hash, Equal> &other)
+{
+    if (&other == this) {
+        // Re-inserting every key in order changes nothing
+        return;
+    }
+    if (isEmpty() && !changeJournal) {
+        copy(other);
+        return;
+    }
+
+    if (changeJournal) {
+        for (const_iterator it = other.begin(); it != other.end(); ++it) {
+            insert(it.key(), it.value());
+        }
+        return;
     }
 
-    OMHashValue pair = it.value();
-    // remove old reference
-    insertOrder.erase(pair.second);
-    // Add new reference
-    QllIterator ioIter = insertOrder.insert(insertOrder.end(), key);
-    pair.first = value;
-    pair.second = ioIter;
-    data.insert(key, pair);
-    return iterator(ioIter, &data);
+    // Nodes are copied with their cached hashes, no key is hashed again
+    int firstNew = nodes.size();
+    nodes.reserve(firstNew + other.size());
+    for (int pos = other.firstLive; pos < other.nodes.size(); ++pos) {
+        if (other.nodes.at(pos).live) {
+            nodes.append(other.nodes.at(pos));
+        }
+    }
+    linkAppended(firstNew);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::isEmpty() const
+{
+    return liveNodes == 0;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::ItemView OrderedMap<Key, Value, Hash, Equal>::items() const
+{
+    return ItemView(item_iterator(begin()), item_iterator(end()));
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMapJournal<Key, Value> *OrderedMap<Key, Value, Hash, Equal>::journal() const
+{
+    return changeJournal;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+const Key &OrderedMap<Key, Value, Hash, Equal>::keyAt(int i) const
+{
+    Q_ASSERT_X(i >= 0 && i < liveNodes, "OrderedMap<Key, Value, Hash, Equal>::keyAt", "index out of range");
+    return nodes.at(positionAt(i)).key;
 }
 
-template <typename Key, typename Value>
-bool OrderedMap<Key, Value>::isEmpty() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+QList<Key> OrderedMap<Key, Value, Hash, Equal>::keys() const
 {
-    return data.isEmpty();
+    QList<Key> keys;
+    keys.reserve(liveNodes);
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        if (nodes.at(pos).live) {
+            keys.append(nodes.at(pos).key);
+        }
+    }
+    return keys;
 }
 
-template<typename Key, typename Value>
-QList<Key> OrderedMap<Key, Value>::keys() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::KeyView OrderedMap<Key, Value, Hash, Equal>::keyView() const
 {
-    return QList<Key>::fromStdList(insertOrder.toStdList());
+    return KeyView(key_iterator(begin()), key_iterator(end()));
 }
 
-template<typename Key, typename Value>
-int OrderedMap<Key, Value>::remove(const Key &key)
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::remove(const Key &key)
 {
-    OMHashIterator it = data.find(key);
-    if (it == data.end()) {
+    int slot;
+    int pos = findNode(key, hashOf(key), &slot);
+    if (pos < 0) {
         return 0;
     }
-    OMHashValue pair = it.value();
-    insertOrder.erase(pair.second);
-    data.erase(it);
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Remove, key);
+    }
+    unlinkSlot(slot);
+    killNode(pos);
     return 1;
 }
 
-template<typename Key, typename Value>
-int OrderedMap<Key, Value>::size() const
+/* Removes every entry for which pred(key, value) returns true, in a single
+ * pass over the map. Returns the number of entries removed.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename Predicate>
+int OrderedMap<Key, Value, Hash, Equal>::removeIf(Predicate pred)
 {
-    return data.size();
+    return sweep(firstLive, nodes.size(), pred);
 }
 
-template<typename Key, typename Value>
-void OrderedMap<Key, Value>::copy(const OrderedMap<Key, Value> &other)
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::reserve(int size)
 {
-    /* Since I'm storing iterators of QLinkedList, I simply cannot make
-     * a trivial copy of the linked list. This is a limitation due to implicit
-     * sharing used in Qt containers, due to which iterator active on one
-     * QLL can change the data of another QLL even after creating a copy.
-     *
-     * Because of this, the old iterators have to be invalidated and new ones
-     * have to be generated.
-     */
-    insertOrder.clear();
-    // Copy hash
-    data = other.data;
+    nodes.reserve(size);
+    reserveIndex(size);
+}
+
+/* The journal is not owned by the map and must outlive it, or be detached
+ * by passing NULL. Copies of a map do not inherit its journal.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::setJournal(OrderedMapJournal<Key, Value> *journal)
+{
+    changeJournal = journal;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::size() const
+{
+    return liveNodes;
+}
+
+/* Reorders the entries so that lessThan(key1, value1, key2, value2) holds for
+ * no entry after another. The sort is stable, so equal entries keep their
+ * relative order. Only the nodes are moved; the index is not rebuilt and no
+ * key is hashed or compared for equality.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename LessThan>
+void OrderedMap<Key, Value, Hash, Equal>::sort(LessThan lessThan)
+{
+    QVector<int> order = livePositions();
+    PositionOrder<LessThan> byEntry = { nodes.constData(), lessThan };
+    std::stable_sort(order.begin(), order.end(), byEntry);
+    permute(order);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::sortByKey()
+{
+    sortByKey(std::less<Key>());
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename LessThan>
+void OrderedMap<Key, Value, Hash, Equal>::sortByKey(LessThan lessThan)
+{
+    KeyOrder<LessThan> byKey = { lessThan };
+    sort(byKey);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::sortByValue()
+{
+    sortByValue(std::less<Value>());
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename LessThan>
+void OrderedMap<Key, Value, Hash, Equal>::sortByValue(LessThan lessThan)
+{
+    ValueOrder<LessThan> byValue = { lessThan };
+    sort(byValue);
+}
+
+// Compacts away removed entries and releases unused memory
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::squeeze()
+{
+    if (liveNodes != nodes.size()) {
+        compact();
+    }
+    nodes.squeeze();
+    ranks.clear();
+    if (liveNodes <= LinearScanLimit) {
+        index.clear();
+    } else if (indexCapacityFor(liveNodes) < index.size()) {
+        reindex(indexCapacityFor(liveNodes), false);
+    }
+    index.squeeze();
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::copy(const OrderedMap<Key, Value, Hash, Equal> &other)
+{
+    // Nodes and index are implicitly shared until either map is modified
+    nodes = other.nodes;
+    index = other.index;
+    ranks = other.ranks;
+    liveNodes = other.liveNodes;
+    firstLive = other.firstLive;
+    indexShift = other.indexShift;
+    journalContents();
+}
+
+// Records the whole map as replacing whatever the journal described before
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::journalContents()
+{
+    if (!changeJournal) {
+        return;
+    }
 
-    QllConstIterator cit = other.insertOrder.begin();
-    for (; cit != other.insertOrder.end(); ++cit) {
-        Key key = *cit;
-        QllIterator ioIter = insertOrder.insert(insertOrder.end(), key);
-        OMHashIterator it = data.find(key);
-        (*it).second = ioIter;
+    changeJournal->record(OrderedMapJournal<Key, Value>::Clear);
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        const Node &node = nodes.at(pos);
+        if (node.live) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Insert, node.key, node.value);
+        }
     }
 }
 
-template<typename Key, typename Value>
-Value OrderedMap<Key, Value>::take(const Key &key)
+template <typename Key, typename Value, typename Hash, typename Equal>
+Value OrderedMap<Key, Value, Hash, Equal>::take(const Key &key)
 {
-    OMHashIterator it = data.find(key);
-    if (it == data.end()) {
+    int slot;
+    int pos = findNode(key, hashOf(key), &slot);
+    if (pos < 0) {
         return Value();
     }
-    OMHashValue pair = it.value();
-    insertOrder.erase(pair.second);
-    data.erase(it);
-    return pair.first;
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Remove, key);
+    }
+    Value value;
+    qSwap(value, nodes[pos].value);
+    unlinkSlot(slot);
+    killNode(pos);
+    return value;
+}
+
+// Removes the n oldest entries, returns the number of entries removed
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::truncateFront(int n)
+{
+    if (n <= 0) {
+        return 0;
+    }
+    int to = n >= liveNodes ? nodes.size() : positionAt(n);
+    return sweep(firstLive, to, EveryEntry());
 }
 
-template <typename Key, typename Value>
-Value OrderedMap<Key, Value>::value(const Key &key) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+Value OrderedMap<Key, Value, Hash, Equal>::value(const Key &key) const
 {
-    return data.value(key).first;
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
+        return Value();
+    }
+    OM_STAT(++counters.hits);
+    return nodes.at(pos).value;
 }
 
-template <typename Key, typename Value>
-Value OrderedMap<Key, Value>::value(const Key &key, const Value &defaultValue) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+Value OrderedMap<Key, Value, Hash, Equal>::value(const Key &key, const Value &defaultValue) const
 {
-    OMHashConstIterator it = data.constFind(key);
-    if (it == data.end()) {
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
         return defaultValue;
     }
-    OMHashValue pair = it.value();
-    return pair.first;
+    OM_STAT(++counters.hits);
+    return nodes.at(pos).value;
 }
 
-template <typename Key, typename Value>
-QList<Value> OrderedMap<Key, Value>::values() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+QList<Value> OrderedMap<Key, Value, Hash, Equal>::values() const
 {
     QList<Value> values;
-    foreach (const Key &key, insertOrder.toStdList()) {
-        OMHashValue v = data.value(key);
-        values.append(v.first);
+    values.reserve(liveNodes);
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        if (nodes.at(pos).live) {
+            values.append(nodes.at(pos).value);
+        }
     }
     return values;
 }
 
-template <typename Key, typename Value>
-OrderedMap<Key, Value> & OrderedMap<Key, Value>::operator=(const OrderedMap<Key, Value>& other)
+/* Adds the entries of other whose keys are not in this map yet, in other's
+ * order. Unlike insert(other), existing entries keep their value and position.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal> &OrderedMap<Key, Value, Hash, Equal>::unite(const OrderedMap<Key, Value, Hash, Equal> &other)
+{
+    if (&other == this) {
+        return *this;
+    }
+
+    if (isEmpty() && !changeJournal) {
+        copy(other);
+        return *this;
+    }
+
+    if (changeJournal) {
+        for (const_iterator it = other.begin(); it != other.end(); ++it) {
+            if (!contains(it.key())) {
+                insert(it.key(), it.value());
+            }
+        }
+        return *this;
+    }
+
+    int firstNew = nodes.size();
+    for (int pos = other.firstLive; pos < other.nodes.size(); ++pos) {
+        const Node &node = other.nodes.at(pos);
+        if (node.live && findNode(node.key, node.hash) < 0) {
+            nodes.append(node);
+        }
+    }
+    linkAppended(firstNew);
+    return *this;
+}
+
+// Like value() for each key, but looked up in batches, see findBatch()
+template <typename Key, typename Value, typename Hash, typename Equal>
+QList<Value> OrderedMap<Key, Value, Hash, Equal>::valuesFor(const QList<Key> &keys) const
+{
+    QList<Value> values;
+    values.reserve(keys.size());
+
+    int positions[LookupBatch];
+    for (int first = 0; first < keys.size(); first += LookupBatch) {
+        int count = qMin(int(LookupBatch), int(keys.size()) - first);
+        findBatch(keys, first, count, positions);
+        for (int i = 0; i < count; ++i) {
+            values.append(positions[i] < 0 ? Value() : nodes.at(positions[i]).value);
+        }
+    }
+    return values;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::ValueView OrderedMap<Key, Value, Hash, Equal>::valueView() const
+{
+    return ValueView(begin(), end());
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal> & OrderedMap<Key, Value, Hash, Equal>::operator=(const OrderedMap<Key, Value, Hash, Equal>& other)
 {
     if (this != &other) {
         copy(other);
@@ -526,106 +1417,897 @@ OrderedMap<Key, Value> & OrderedMap<Key, Value>::operator=(const OrderedMap<Key,
 }
 
 #if (QT_VERSION >= 0x050200)
-template <typename Key, typename Value>
-OrderedMap<Key, Value> & OrderedMap<Key, Value>::operator=(OrderedMap<Key, Value>&& other)
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMap<Key, Value, Hash, Equal> & OrderedMap<Key, Value, Hash, Equal>::operator=(OrderedMap<Key, Value, Hash, Equal>&& other)
 {
     if (this != &other) {
-        data = other.data;
-        insertOrder = other.insertOrder;
+        nodes = std::move(other.nodes);
+        index = std::move(other.index);
+        ranks = std::move(other.ranks);
+        liveNodes = other.liveNodes;
+        firstLive = other.firstLive;
+        indexShift = other.indexShift;
+        other.reset();
+        journalContents();
     }
     return *this;
 }
 #endif
 
-template <typename Key, typename Value>
-bool OrderedMap<Key, Value>::operator==(const OrderedMap<Key, Value> &other) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::operator==(const OrderedMap<Key, Value, Hash, Equal> &other) const
 {
     // 2 Ordered maps are equal if they have the same contents in the same order
-    return ((data == other.data) && (insertOrder == other.insertOrder));
+    if (liveNodes != other.liveNodes) {
+        return false;
+    }
+    // A copy that was never modified still shares the nodes
+    if (nodes.isSharedWith(other.nodes)) {
+        return true;
+    }
+
+    /* One walk over both node vectors, skipping holes. The cached hashes
+     * differ for almost any two different keys, so they are compared first.
+     * Both have as many live nodes, so other cannot run out first.
+     */
+    const Node *node = nodes.constData() + firstLive;
+    const Node *last = nodes.constData() + nodes.size();
+    const Node *otherNode = other.nodes.constData() + other.firstLive;
+    for (; node != last; ++node) {
+        if (!node->live) {
+            continue;
+        }
+        while (!otherNode->live) {
+            ++otherNode;
+        }
+        if (node->hash != otherNode->hash || !keysEqual(node->key, otherNode->key)
+                || !(node->value == otherNode->value)) {
+            return false;
+        }
+        ++otherNode;
+    }
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::operator!=(const OrderedMap<Key, Value, Hash, Equal> &other) const
+{
+    return !(*this == other);
+}
+
+#ifdef ORDEREDMAP_ENABLE_STATS
+template <typename Key, typename Value, typename Hash, typename Equal>
+OrderedMapStats OrderedMap<Key, Value, Hash, Equal>::stats() const
+{
+    OrderedMapStats snapshot = counters;
+
+    if (index.isEmpty()) {
+        // Small map, a lookup scans the nodes up to its key
+        snapshot.maxProbeLength = nodes.size() - firstLive;
+        snapshot.averageChainLength = liveNodes ? qreal(liveNodes + 1) / 2 : 0;
+        return snapshot;
+    }
+
+    // A key's chain is its probe sequence, from its home slot to its own
+    const int mask = index.size() - 1;
+    qint64 totalProbes = 0;
+    int longestProbe = 0;
+    for (int slot = 0; slot < index.size(); ++slot) {
+        const IndexSlot &s = index.at(slot);
+        if (s.pos) {
+            int probes = ((slot - homeSlot(s.hash)) & mask) + 1;
+            totalProbes += probes;
+            longestProbe = qMax(longestProbe, probes);
+        }
+    }
+    snapshot.maxProbeLength = longestProbe;
+    snapshot.averageChainLength = liveNodes ? qreal(totalProbes) / liveNodes : 0;
+    return snapshot;
 }
 
-template <typename Key, typename Value>
-bool OrderedMap<Key, Value>::operator!=(const OrderedMap<Key, Value> &other) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::resetStats()
 {
-    return ((data != other.data) || (insertOrder != other.insertOrder));
+    counters = OrderedMapStats();
 }
+#endif
 
-template <typename Key, typename Value>
-Value& OrderedMap<Key, Value>::operator[](const Key &key)
+template <typename Key, typename Value, typename Hash, typename Equal>
+Value& OrderedMap<Key, Value, Hash, Equal>::operator[](const Key &key)
 {
-    OMHashIterator it = data.find(key);
-    if (it == data.end()) {
-        insert(key, Value());
-        it = data.find(key);
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
+        return insert(key, Value()).value();
     }
-    OMHashValue &pair = it.value();
-    return pair.first;
+    OM_STAT(++counters.hits);
+    return nodes[pos].value;
 }
 
-template <typename Key, typename Value>
-const Value OrderedMap<Key, Value>::operator[](const Key &key) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+const Value OrderedMap<Key, Value, Hash, Equal>::operator[](const Key &key) const
 {
     return value(key);
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::iterator OrderedMap<Key, Value>::begin()
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::begin()
 {
-    return iterator(insertOrder.begin(), &data);
+    return iterator(this, firstLive);
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::const_iterator OrderedMap<Key, Value>::begin() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::const_iterator OrderedMap<Key, Value, Hash, Equal>::begin() const
 {
-    return const_iterator(insertOrder.begin(), &data);
+    return const_iterator(this, firstLive);
 }
 
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::iterator OrderedMap<Key, Value>::end()
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::end()
 {
-    return iterator(insertOrder.end(), &data);
+    return iterator(this, nodes.size());
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::const_iterator OrderedMap<Key, Value>::end() const
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::const_iterator OrderedMap<Key, Value, Hash, Equal>::end() const
 {
-    return const_iterator(insertOrder.end(), &data);
+    return const_iterator(this, nodes.size());
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::iterator OrderedMap<Key, Value>::erase(iterator pos)
+/* Erasing never compacts the nodes, so other iterators stay valid and
+ * entries can be erased while iterating.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::erase(iterator pos)
 {
-    OMHashIterator hit = data.find(*(pos.qllIter));
-    if (hit == data.end()) {
+    if (pos.pos < 0 || pos.pos >= nodes.size() || !nodes.at(pos.pos).live) {
         return pos;
     }
-    data.erase(hit);
-    QllIterator ioIter = insertOrder.erase(pos.qllIter);
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Remove, nodes.at(pos.pos).key);
+    }
+    int next = nextLive(pos.pos);
+    unlinkSlot(slotOf(pos.pos));
+    killNode(pos.pos);
+
+    return iterator(this, next);
+}
+
+// Erases the entries in [first, last), returns last
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::erase(iterator first, iterator last)
+{
+    sweep(first.pos, last.pos, EveryEntry());
+    return iterator(this, last.pos);
+}
 
-    return iterator(ioIter, &data);
+// Removes key from the map and returns its entry, or an empty node
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::node_type OrderedMap<Key, Value, Hash, Equal>::extract(const Key &key)
+{
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        return node_type();
+    }
+    return extract(iterator(this, pos));
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::iterator OrderedMap<Key, Value>::find(const Key& key)
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::node_type OrderedMap<Key, Value, Hash, Equal>::extract(iterator pos)
 {
-    OMHashIterator hit = data.find(key);
-    if (hit == data.end()) {
+    node_type node;
+    if (pos.pos < 0 || pos.pos >= nodes.size() || !nodes.at(pos.pos).live) {
+        return node;
+    }
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Remove, nodes.at(pos.pos).key);
+    }
+
+    Node &entry = nodes[pos.pos];
+    qSwap(node.nodeKey, entry.key);
+    qSwap(node.nodeValue, entry.value);
+    node.hash = entry.hash;
+    node.holdsEntry = true;
+    unlinkSlot(slotOf(pos.pos));
+    killNode(pos.pos);
+    return node;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::find(const Key& key)
+{
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
         return end();
     }
 
-    return iterator(hit.value().second, &data);
+    OM_STAT(++counters.hits);
+    return iterator(this, pos);
 }
 
-template <typename Key, typename Value>
-typename OrderedMap<Key, Value>::const_iterator OrderedMap<Key, Value>::find(const Key& key) const
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::const_iterator OrderedMap<Key, Value, Hash, Equal>::find(const Key& key) const
 {
-    OMHashConstIterator hit = data.find(key);
-    if (hit == data.end()) {
+    int pos = findNode(key, hashOf(key));
+    if (pos < 0) {
+        OM_STAT(++counters.misses);
         return end();
     }
 
-    return const_iterator(hit.value().second, &data);
+    OM_STAT(++counters.hits);
+    return const_iterator(this, pos);
+}
+
+/* Moves the entry at pos, an iterator into other, to this map as insert()
+ * would add it. Returns an iterator to the entry in this map, or end() if pos
+ * is other.end(). Key and value are moved rather than copied.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+typename OrderedMap<Key, Value, Hash, Equal>::iterator OrderedMap<Key, Value, Hash, Equal>::splice(OrderedMap<Key, Value, Hash, Equal> &other, iterator pos)
+{
+    node_type node = other.extract(pos);
+    return insert(node);
 }
 
+// Moves n live entries forward (or back, if negative) from node position pos
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::advance(int pos, int n) const
+{
+    if (liveNodes == nodes.size()) {
+        return pos + n;
+    }
+
+    // Short hops just skip the holes, longer ones go through the ranks
+    if (n >= 0 && n <= 8) {
+        while (n--) {
+            pos = nextLive(pos);
+        }
+        return pos;
+    }
+    if (n < 0 && n >= -8) {
+        while (n++) {
+            pos = previousLive(pos);
+        }
+        return pos;
+    }
+
+    int rank = rankOf(pos) + n;
+    return rank >= liveNodes ? nodes.size() : positionAt(rank);
+}
+
+// Appends a node, swapping key and value into it, so neither is copied
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::adoptNode(Key &key, Value &value, uint hash)
+{
+    nodes.append(Node());
+    Node &node = nodes.last();
+    qSwap(node.key, key);
+    qSwap(node.value, value);
+    node.hash = hash;
+    node.live = true;
+
+    int pos = nodes.size() - 1;
+    if (liveNodes == 0) {
+        firstLive = pos;
+    }
+    ++liveNodes;
+
+    if (!ranks.isEmpty()) {
+        // The new entry covers itself and the ranks of the nodes below it
+        int i = pos + 1;
+        int below = 0;
+        for (int j = pos; j > 0; j -= j & -j) {
+            below += ranks.at(j);
+        }
+        for (int j = i - (i & -i); j > 0; j -= j & -j) {
+            below -= ranks.at(j);
+        }
+        ranks.append(below + 1);
+    }
+    return pos;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::appendNode(const Key &key, const Value &value, uint hash)
+{
+    // Copied before appending, as key or value may refer to another node
+    Key nodeKey(key);
+    Value nodeValue(value);
+    return adoptNode(nodeKey, nodeValue, hash);
+}
+
+// ranks[i] counts the live nodes in positions [i - (i & -i), i)
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::buildRanks()
+{
+    const int n = nodes.size();
+    ranks.fill(0, n + 1);
+    int *r = ranks.data();
+    for (int i = 1; i <= n; ++i) {
+        r[i] += nodes.at(i - 1).live;
+        int parent = i + (i & -i);
+        if (parent <= n) {
+            r[parent] += r[i];
+        }
+    }
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::compact()
+{
+    Node *n = nodes.data();
+    int live = 0;
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        if (n[pos].live) {
+            if (pos != live) {
+                qSwap(n[live], n[pos]);
+            }
+            ++live;
+        }
+    }
+    nodes.resize(live);
+    firstLive = 0;
+    ranks.clear();
+    if (!index.isEmpty()) {
+        reindex(index.size(), false);
+    }
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::compactIfSparse()
+{
+    int holes = nodes.size() - liveNodes;
+    // Without an index every lookup walks the holes too, so drop them sooner
+    int minHoles = index.isEmpty() ? int(LinearScanLimit) : 16;
+    if (holes < minHoles || holes <= liveNodes) {
+        return false;
+    }
+    compact();
+    return true;
+}
+
+/* Resolves count keys starting at keys[first] to node positions, or -1 for
+ * missing keys. On a large map every lookup is two dependent cache misses,
+ * one in the index and one in the nodes. Rather than paying them one key at a
+ * time, all index slots of the batch are prefetched first, then all candidate
+ * nodes, and only then are keys compared, so the misses overlap.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::findBatch(const QList<Key> &keys, int first, int count, int *positions) const
+{
+    if (index.isEmpty()) {
+        for (int i = 0; i < count; ++i) {
+            const Key &key = keys.at(first + i);
+            positions[i] = findNode(key, hashOf(key));
+            OM_STAT(positions[i] < 0 ? ++counters.misses : ++counters.hits);
+        }
+        return;
+    }
+
+    const IndexSlot *table = index.constData();
+    const Node *n = nodes.constData();
+    const int mask = index.size() - 1;
+    uint hashes[LookupBatch];
+    int candidates[LookupBatch];
+
+    for (int i = 0; i < count; ++i) {
+        hashes[i] = hashOf(keys.at(first + i));
+        candidates[i] = homeSlot(hashes[i]);
+        OM_PREFETCH(table + candidates[i]);
+    }
+
+    // Skip ahead to the first slot with a matching hash, without touching nodes
+    for (int i = 0; i < count; ++i) {
+        int slot = candidates[i];
+        while (table[slot].pos && table[slot].hash != hashes[i]) {
+            slot = (slot + 1) & mask;
+        }
+        candidates[i] = slot;
+        if (table[slot].pos) {
+            OM_PREFETCH(n + table[slot].pos - 1);
+        }
+    }
+
+    for (int i = 0; i < count; ++i) {
+        const Key &key = keys.at(first + i);
+        positions[i] = -1;
+        for (int slot = candidates[i]; table[slot].pos; slot = (slot + 1) & mask) {
+            if (table[slot].hash == hashes[i] && keysEqual(n[table[slot].pos - 1].key, key)) {
+                positions[i] = table[slot].pos - 1;
+                break;
+            }
+        }
+        OM_STAT(positions[i] < 0 ? ++counters.misses : ++counters.hits);
+    }
+}
+
+/* Returns the node position of key, or -1. If slot is given, it is set to the
+ * index slot holding key or, on a miss, to the free slot ending the probe
+ * sequence, where the key would be inserted. A small map has no index: its
+ * nodes are scanned instead, comparing cached hashes first, and slot is -1.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::findNode(const Key &key, uint hash, int *slot) const
+{
+    const Node *n = nodes.constData();
+
+    if (index.isEmpty()) {
+        if (slot) {
+            *slot = -1;
+        }
+        const int end = nodes.size();
+        for (int pos = firstLive; pos < end; ++pos) {
+            if (n[pos].hash == hash && n[pos].live && keysEqual(n[pos].key, key)) {
+                return pos;
+            }
+        }
+        return -1;
+    }
+
+    const IndexSlot *table = index.constData();
+    const int mask = index.size() - 1;
+    int probe = homeSlot(hash);
+    for (; table[probe].pos; probe = (probe + 1) & mask) {
+        if (table[probe].hash == hash && keysEqual(n[table[probe].pos - 1].key, key)) {
+            break;
+        }
+    }
+    if (slot) {
+        *slot = probe;
+    }
+    return table[probe].pos - 1;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+uint OrderedMap<Key, Value, Hash, Equal>::hashOf(const Key &key)
+{
+    return Hash()(key);
+}
+
+// Fibonacci hashing, so keys with poorly mixed hashes still spread out
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::homeSlot(uint hash) const
+{
+    return int((hash * 0x9E3779B9U) >> indexShift);
+}
+
+// Keeps the index at most half full, so probe sequences stay short
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::indexCapacityFor(int count)
+{
+    int capacity = 8;
+    while (capacity / 2 < count) {
+        capacity *= 2;
+    }
+    return capacity;
+}
+
+// Inserts key only if it is not in the map yet, returns whether it was added
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::insertNew(const Key &key, const Value &value)
+{
+    uint hash = hashOf(key);
+    int slot;
+    if (findNode(key, hash, &slot) >= 0) {
+        OM_STAT(++counters.hits);
+        return false;
+    }
+
+    if (reserveIndex(liveNodes + 1)) {
+        findNode(key, hash, &slot);
+    }
+    int pos = appendNode(key, value, hash);
+    linkSlot(slot, hash, pos);
+    OM_STAT(++counters.inserts);
+    if (changeJournal) {
+        changeJournal->record(OrderedMapJournal<Key, Value>::Insert, key, value);
+    }
+    compactIfSparse();
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::keysEqual(const Key &key1, const Key &key2)
+{
+    return Equal()(key1, key2);
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::killNode(int pos)
+{
+    Node &node = nodes[pos];
+    node.live = false;
+    node.key = Key();
+    node.value = Value();
+    --liveNodes;
+
+    if (ranks.isEmpty()) {
+        buildRanks();
+    } else {
+        for (int i = pos + 1; i < ranks.size(); i += i & -i) {
+            --ranks[i];
+        }
+    }
+    if (pos == firstLive) {
+        firstLive = nextLive(pos);
+    }
+}
+
+/* Indexes the nodes appended from firstNew on. A key already in the map, or
+ * repeated among the new nodes, keeps only its last entry, as it would after
+ * an insert() per node. The index grows at most once, and is rebuilt from
+ * the cached hashes if it does. A map that stays small gets no index.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::linkAppended(int firstNew)
+{
+    int added = nodes.size() - firstNew;
+    if (added == 0) {
+        return;
+    }
+
+    // Cheaper to rebuild once than to extend node by node
+    ranks.clear();
+    if (liveNodes == 0) {
+        firstLive = firstNew;
+    }
+    OM_STAT(int oldLive = liveNodes);
+    liveNodes += added;
+
+    if (index.isEmpty() && liveNodes <= LinearScanLimit) {
+        for (int pos = firstNew; pos < nodes.size(); ++pos) {
+            const Node &node = nodes.at(pos);
+            for (int earlier = firstLive; earlier < pos; ++earlier) {
+                const Node &other = nodes.at(earlier);
+                if (other.hash == node.hash && other.live && keysEqual(other.key, node.key)) {
+                    killNode(earlier);
+                    break;
+                }
+            }
+        }
+    } else if (liveNodes > index.size() / 2) {
+        OM_STAT(++counters.rehashes);
+        reindex(indexCapacityFor(liveNodes), true);
+    } else {
+        for (int pos = firstNew; pos < nodes.size(); ++pos) {
+            const Node &node = nodes.at(pos);
+            int slot;
+            int existing = findNode(node.key, node.hash, &slot);
+            if (existing >= 0) {
+                killNode(existing);
+            }
+            linkSlot(slot, node.hash, pos);
+        }
+    }
+
+    OM_STAT(int replaced = oldLive + added - liveNodes);
+    OM_STAT(counters.inserts += added - replaced);
+    OM_STAT(counters.overwrites += replaced);
+    OM_STAT(counters.relinks += replaced);
+    if (!compactIfSparse() && ranks.isEmpty() && liveNodes != nodes.size()) {
+        buildRanks();
+    }
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::linkSlot(int slot, uint hash, int pos)
+{
+    if (slot >= 0) {
+        index[slot].hash = hash;
+        index[slot].pos = pos + 1;
+    }
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+QVector<int> OrderedMap<Key, Value, Hash, Equal>::livePositions() const
+{
+    QVector<int> positions;
+    positions.reserve(liveNodes);
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        if (nodes.at(pos).live) {
+            positions.append(pos);
+        }
+    }
+    return positions;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::nextLive(int pos) const
+{
+    const int n = nodes.size();
+    for (++pos; pos < n && !nodes.at(pos).live; ++pos) {}
+    return pos;
+}
+
+/* Moves the live nodes into the order of their positions in order, dropping
+ * the holes. Index slots stay where they are and are only pointed at the new
+ * positions, so the index is neither rehashed nor probed.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::permute(const QVector<int> &order)
+{
+    // Where each live node goes; no slot points at a hole
+    QVector<int> target(nodes.size());
+    for (int i = 0; i < order.size(); ++i) {
+        target[order.at(i)] = i;
+    }
+
+    IndexSlot *table = index.data();
+    for (int slot = 0; slot < index.size(); ++slot) {
+        if (table[slot].pos) {
+            table[slot].pos = target.at(table[slot].pos - 1) + 1;
+        }
+    }
+
+    // Nodes are swapped into place, so no key or value is copied
+    QVector<Node> permuted(order.size());
+    Node *node = nodes.data();
+    Node *to = permuted.data();
+    for (int i = 0; i < order.size(); ++i) {
+        qSwap(to[i], node[order.at(i)]);
+    }
+    nodes.swap(permuted);
+    firstLive = 0;
+    ranks.clear();
+
+    // Moving every key to the end in the new order replays the sort
+    if (changeJournal) {
+        for (int pos = 0; pos < nodes.size(); ++pos) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Move, nodes.at(pos).key);
+        }
+    }
+}
+
+// Node position of the entry at index rank in insertion order
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::positionAt(int rank) const
+{
+    if (liveNodes == nodes.size()) {
+        return rank;
+    }
+
+    // Descend the tree for the last position with at most rank live nodes
+    const int n = nodes.size();
+    int step = 1;
+    while (step * 2 <= n) {
+        step *= 2;
+    }
+    int pos = 0;
+    int remaining = rank + 1;
+    for (; step; step /= 2) {
+        if (pos + step <= n && ranks.at(pos + step) < remaining) {
+            pos += step;
+            remaining -= ranks.at(pos);
+        }
+    }
+    return pos;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::previousLive(int pos) const
+{
+    for (--pos; pos > 0 && !nodes.at(pos).live; --pos) {}
+    return pos;
+}
+
+// Number of live entries before node position pos
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::rankOf(int pos) const
+{
+    if (liveNodes == nodes.size()) {
+        return pos;
+    }
+
+    int rank = 0;
+    for (int i = pos; i > 0; i -= i & -i) {
+        rank += ranks.at(i);
+    }
+    return rank;
+}
+
+/* Rebuilds the index from the cached hashes. With dropDuplicates, a key found
+ * again later in the nodes replaces the earlier one, as insert() would.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::reindex(int capacity, bool dropDuplicates)
+{
+    IndexSlot unused = { 0, 0 };
+    index.fill(unused, capacity);
+    int bits = 0;
+    while ((1 << bits) < capacity) {
+        ++bits;
+    }
+    indexShift = 32 - bits;
+
+    IndexSlot *table = index.data();
+    Node *n = nodes.data();
+    const int mask = capacity - 1;
+    for (int pos = firstLive; pos < nodes.size(); ++pos) {
+        if (!n[pos].live) {
+            continue;
+        }
+        int slot = homeSlot(n[pos].hash);
+        for (; table[slot].pos; slot = (slot + 1) & mask) {
+            if (dropDuplicates && table[slot].hash == n[pos].hash
+                    && keysEqual(n[table[slot].pos - 1].key, n[pos].key)) {
+                killNode(table[slot].pos - 1);
+                break;
+            }
+        }
+        table[slot].hash = n[pos].hash;
+        table[slot].pos = pos + 1;
+    }
+}
+
+// Backward shift deletion, so lookups never have to skip tombstones
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::removeFromIndex(int slot)
+{
+    IndexSlot *table = index.data();
+    const int mask = index.size() - 1;
+    int hole = slot;
+    for (int next = (hole + 1) & mask; table[next].pos; next = (next + 1) & mask) {
+        // Move the entry back unless the hole is before its home slot
+        int home = homeSlot(table[next].hash);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table[hole] = table[next];
+            hole = next;
+        }
+    }
+    table[hole].hash = 0;
+    table[hole].pos = 0;
+}
+
+/* Grows the index to hold count entries, returns true if it was rebuilt. A
+ * small map is only given an index once it outgrows LinearScanLimit.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+bool OrderedMap<Key, Value, Hash, Equal>::reserveIndex(int count)
+{
+    if (count <= index.size() / 2) {
+        return false;
+    }
+    if (index.isEmpty() && count <= LinearScanLimit) {
+        return false;
+    }
+    OM_STAT(++counters.rehashes);
+    reindex(indexCapacityFor(count), false);
+    return true;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::reset()
+{
+    nodes.clear();
+    index.clear();
+    ranks.clear();
+    liveNodes = 0;
+    firstLive = 0;
+}
+
+/* Removes the entries in node positions [from, to) that pred accepts, in one
+ * pass. Each is unlinked from the index as it goes, until more than a quarter
+ * of the map is gone; past that, the index is rebuilt once at the end, which
+ * is cheaper than unlinking the rest. Like erase(), this never compacts the
+ * nodes, so iterators stay valid.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+template <typename Predicate>
+int OrderedMap<Key, Value, Hash, Equal>::sweep(int from, int to, Predicate pred)
+{
+    const int unlinkLimit = liveNodes / 4;
+    int removed = 0;
+
+    for (int pos = from; pos < to; ++pos) {
+        Node &node = nodes[pos];
+        if (!node.live || !pred(node.key, node.value)) {
+            continue;
+        }
+        if (changeJournal) {
+            changeJournal->record(OrderedMapJournal<Key, Value>::Remove, node.key);
+        }
+        if (removed < unlinkLimit) {
+            unlinkSlot(slotOf(pos));
+        }
+        node.live = false;
+        node.key = Key();
+        node.value = Value();
+        ++removed;
+    }
+
+    liveNodes -= removed;
+    while (firstLive < nodes.size() && !nodes.at(firstLive).live) {
+        ++firstLive;
+    }
+    // Cheaper to rebuild once than to update entry by entry
+    if (removed) {
+        buildRanks();
+    }
+    if (removed > unlinkLimit && !index.isEmpty()) {
+        reindex(index.size(), false);
+    }
+    return removed;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+int OrderedMap<Key, Value, Hash, Equal>::slotOf(int pos) const
+{
+    if (index.isEmpty()) {
+        return -1;
+    }
+    const int mask = index.size() - 1;
+    int slot = homeSlot(nodes.at(pos).hash);
+    while (index.at(slot).pos != pos + 1) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+void OrderedMap<Key, Value, Hash, Equal>::unlinkSlot(int slot)
+{
+    if (slot >= 0) {
+        removeFromIndex(slot);
+    }
+}
+
+/* The stream format is the entry count followed by each key and value in
+ * insertion order, so reading it back restores the same order.
+ */
+template <typename Key, typename Value, typename Hash, typename Equal>
+QDataStream &operator<<(QDataStream &out, const OrderedMap<Key, Value, Hash, Equal> &map)
+{
+    out << quint32(map.size());
+    typename OrderedMap<Key, Value, Hash, Equal>::const_iterator it = map.begin();
+    for (; it != map.end(); ++it) {
+        out << it.key() << it.value();
+    }
+    return out;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal>
+QDataStream &operator>>(QDataStream &in, OrderedMap<Key, Value, Hash, Equal> &map)
+{
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::Node Node;
+
+    OrderedMapJournal<Key, Value> *journal = map.changeJournal;
+    map.changeJournal = NULL;
+    map.clear();
+    map.changeJournal = journal;
+
+    quint32 n;
+    in >> n;
+    // The count is not trusted with more than a modest reservation
+    map.nodes.reserve(int(qMin(n, quint32(1) << 16)));
+
+    for (quint32 i = 0; i < n; ++i) {
+        Key key;
+        Value value;
+        in >> key >> value;
+        if (in.status() != QDataStream::Ok) {
+            break;
+        }
+
+        Node node = { key, OrderedMap<Key, Value, Hash, Equal>::hashOf(key), true, value };
+        map.nodes.append(node);
+    }
+
+    /* Indexing once at the end is cheaper than an insert() per entry. A key
+     * repeated in the stream behaves like insert(): last one wins and takes
+     * the later position.
+     */
+    map.linkAppended(0);
+
+    if (in.status() != QDataStream::Ok) {
+        map.clear();
+    } else {
+        map.journalContents();
+    }
+    return in;
+}
+
+#include "orderedmapjournal.h"
+
 #endif // ORDEREDMAP_H
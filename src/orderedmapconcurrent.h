@@ -0,0 +1,302 @@
+#ifndef ORDEREDMAPCONCURRENT_H
+#define ORDEREDMAPCONCURRENT_H
+
+#include <QtGlobal>
+#include <QThreadPool>
+#include <QVector>
+#include <QtConcurrentMap>
+
+#include <algorithm>
+
+#include "orderedmap.h"
+
+/* Parallel algorithms over the entries of an OrderedMap, run on the global
+ * QThreadPool. Projects using them need QT += concurrent with Qt 5.
+ *
+ * The map's storage is split into contiguous chunks of entries, a few per
+ * thread, and each chunk is handled by one thread from start to end. Results
+ * are put back together in chunk order, so they keep the map's insertion
+ * order. The functions passed in are called from several threads at once
+ * and must be safe to call that way; the map must not be modified until the
+ * call returns.
+ */
+struct OrderedMapConcurrent
+{
+    /* Returns a map with the same keys in the same order, each mapped to
+     * function(key, value). The result shares the source's hash index, so no
+     * key is hashed or compared again.
+     */
+    template <typename T, typename Key, typename Value, typename Hash, typename Equal, typename Function>
+    static OrderedMap<Key, T, Hash, Equal> mapValues(const OrderedMap<Key, Value, Hash, Equal> &map,
+                                                     Function function);
+
+    // Returns the entries for which pred(key, value) is true, in order
+    template <typename Key, typename Value, typename Hash, typename Equal, typename Predicate>
+    static OrderedMap<Key, Value, Hash, Equal> filtered(const OrderedMap<Key, Value, Hash, Equal> &map,
+                                                        Predicate pred);
+
+    /* Folds the entries into a T. Each chunk starts from initial and calls
+     * accumulate(T &result, key, value) for its entries in order; the chunk
+     * results are then merged left to right with combine(T &result, const T
+     * &chunkResult). initial must therefore be an identity for combine, and
+     * combine must be associative, as for a sum or a concatenation.
+     */
+    template <typename T, typename Key, typename Value, typename Hash, typename Equal,
+              typename Accumulate, typename Combine>
+    static T reduce(const OrderedMap<Key, Value, Hash, Equal> &map, const T &initial,
+                    Accumulate accumulate, Combine combine);
+
+    /* Sorts the map in place, with the same result as OrderedMap::sort().
+     * Chunks are sorted in parallel, then neighbouring chunks are merged in
+     * pairs, each round in parallel, until one is left.
+     */
+    template <typename Key, typename Value, typename Hash, typename Equal, typename LessThan>
+    static void sort(OrderedMap<Key, Value, Hash, Equal> &map, LessThan lessThan);
+
+private:
+    // Chunks smaller than this cost more to schedule than they save
+    enum { MinChunkSize = 4096 };
+
+    // Node positions [begin, end) and what was computed for them
+    template <typename T>
+    struct Chunk
+    {
+        int begin;
+        int end;
+        T result;
+    };
+
+    template <typename T>
+    static QVector<Chunk<T> > split(int begin, int end, const T &initial);
+
+    template <typename SourceNode, typename TargetNode, typename Function>
+    struct MapTask
+    {
+        typedef void result_type;
+
+        const SourceNode *source;
+        TargetNode *target;
+        Function function;
+
+        void operator()(const Chunk<int> &chunk) const
+        {
+            // Holes are copied too, so that positions match the shared index
+            for (int pos = chunk.begin; pos < chunk.end; ++pos) {
+                const SourceNode &from = source[pos];
+                TargetNode &to = target[pos];
+                if (from.live) {
+                    to.key = from.key;
+                    to.value = function(from.key, from.value);
+                }
+                to.hash = from.hash;
+                to.live = from.live;
+            }
+        }
+    };
+
+    template <typename Node, typename Predicate>
+    struct FilterTask
+    {
+        typedef void result_type;
+
+        const Node *source;
+        char *keep;
+        Predicate pred;
+
+        void operator()(Chunk<int> &chunk) const
+        {
+            int kept = 0;
+            for (int pos = chunk.begin; pos < chunk.end; ++pos) {
+                const Node &node = source[pos];
+                keep[pos] = node.live && pred(node.key, node.value);
+                kept += keep[pos];
+            }
+            chunk.result = kept;
+        }
+    };
+
+    // Copies the entries a FilterTask kept, chunk.result being their offset
+    template <typename Node>
+    struct GatherTask
+    {
+        typedef void result_type;
+
+        const Node *source;
+        const char *keep;
+        Node *target;
+
+        void operator()(const Chunk<int> &chunk) const
+        {
+            Node *to = target + chunk.result;
+            for (int pos = chunk.begin; pos < chunk.end; ++pos) {
+                if (keep[pos]) {
+                    *to++ = source[pos];
+                }
+            }
+        }
+    };
+
+    template <typename Order>
+    struct SortTask
+    {
+        typedef void result_type;
+
+        int *positions;
+        Order order;
+
+        void operator()(const Chunk<int> &chunk) const
+        {
+            std::stable_sort(positions + chunk.begin, positions + chunk.end, order);
+        }
+    };
+
+    // Merges two sorted runs, the second starting at chunk.result
+    template <typename Order>
+    struct MergeTask
+    {
+        typedef void result_type;
+
+        int *positions;
+        Order order;
+
+        void operator()(const Chunk<int> &chunk) const
+        {
+            std::inplace_merge(positions + chunk.begin, positions + chunk.result,
+                               positions + chunk.end, order);
+        }
+    };
+
+    template <typename T, typename Node, typename Accumulate>
+    struct ReduceTask
+    {
+        typedef void result_type;
+
+        const Node *source;
+        Accumulate accumulate;
+
+        void operator()(Chunk<T> &chunk) const
+        {
+            for (int pos = chunk.begin; pos < chunk.end; ++pos) {
+                if (source[pos].live) {
+                    accumulate(chunk.result, source[pos].key, source[pos].value);
+                }
+            }
+        }
+    };
+};
+
+template <typename T, typename Key, typename Value, typename Hash, typename Equal, typename Function>
+OrderedMap<Key, T, Hash, Equal> OrderedMapConcurrent::mapValues(const OrderedMap<Key, Value, Hash, Equal> &map,
+                                                                Function function)
+{
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::Node SourceNode;
+    typedef typename OrderedMap<Key, T, Hash, Equal>::Node TargetNode;
+
+    OrderedMap<Key, T, Hash, Equal> result;
+    result.nodes.resize(map.nodes.size());
+    result.index = map.index;
+    result.ranks = map.ranks;
+    result.liveNodes = map.liveNodes;
+    result.firstLive = map.firstLive;
+    result.indexShift = map.indexShift;
+
+    QVector<Chunk<int> > chunks = split(map.firstLive, map.nodes.size(), 0);
+    MapTask<SourceNode, TargetNode, Function> task = {
+        map.nodes.constData(), result.nodes.data(), function
+    };
+    QtConcurrent::blockingMap(chunks, task);
+    return result;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal, typename Predicate>
+OrderedMap<Key, Value, Hash, Equal> OrderedMapConcurrent::filtered(const OrderedMap<Key, Value, Hash, Equal> &map,
+                                                                   Predicate pred)
+{
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::Node Node;
+
+    const Node *source = map.nodes.constData();
+    QVector<char> keep(map.nodes.size());
+    QVector<Chunk<int> > chunks = split(map.firstLive, map.nodes.size(), 0);
+    FilterTask<Node, Predicate> filter = { source, keep.data(), pred };
+    QtConcurrent::blockingMap(chunks, filter);
+
+    // Turn the per-chunk counts into offsets in the result
+    int kept = 0;
+    for (int i = 0; i < chunks.size(); ++i) {
+        int count = chunks.at(i).result;
+        chunks[i].result = kept;
+        kept += count;
+    }
+
+    OrderedMap<Key, Value, Hash, Equal> result;
+    result.nodes.resize(kept);
+    GatherTask<Node> gather = { source, keep.constData(), result.nodes.data() };
+    QtConcurrent::blockingMap(chunks, gather);
+
+    // Keys are unique and hashes cached, so indexing never hashes a key
+    result.linkAppended(0);
+    return result;
+}
+
+template <typename T, typename Key, typename Value, typename Hash, typename Equal,
+          typename Accumulate, typename Combine>
+T OrderedMapConcurrent::reduce(const OrderedMap<Key, Value, Hash, Equal> &map, const T &initial,
+                               Accumulate accumulate, Combine combine)
+{
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::Node Node;
+
+    QVector<Chunk<T> > chunks = split(map.firstLive, map.nodes.size(), initial);
+    ReduceTask<T, Node, Accumulate> task = { map.nodes.constData(), accumulate };
+    QtConcurrent::blockingMap(chunks, task);
+
+    T result = initial;
+    for (int i = 0; i < chunks.size(); ++i) {
+        combine(result, chunks.at(i).result);
+    }
+    return result;
+}
+
+template <typename Key, typename Value, typename Hash, typename Equal, typename LessThan>
+void OrderedMapConcurrent::sort(OrderedMap<Key, Value, Hash, Equal> &map, LessThan lessThan)
+{
+    typedef typename OrderedMap<Key, Value, Hash, Equal>::template PositionOrder<LessThan> Order;
+
+    QVector<int> positions = map.livePositions();
+    Order order = { map.nodes.constData(), lessThan };
+    QVector<Chunk<int> > chunks = split(0, positions.size(), 0);
+    SortTask<Order> sortTask = { positions.data(), order };
+    QtConcurrent::blockingMap(chunks, sortTask);
+
+    MergeTask<Order> mergeTask = { positions.data(), order };
+    while (chunks.size() > 1) {
+        QVector<Chunk<int> > merged;
+        for (int i = 0; i + 1 < chunks.size(); i += 2) {
+            Chunk<int> pair = { chunks.at(i).begin, chunks.at(i + 1).end, chunks.at(i + 1).begin };
+            merged.append(pair);
+        }
+        QtConcurrent::blockingMap(merged, mergeTask);
+        if (chunks.size() % 2) {
+            merged.append(chunks.last());
+        }
+        chunks = merged;
+    }
+
+    map.permute(positions);
+}
+
+// A few chunks per thread, so that uneven work still balances out
+template <typename T>
+QVector<OrderedMapConcurrent::Chunk<T> > OrderedMapConcurrent::split(int begin, int end, const T &initial)
+{
+    const int threads = qMax(1, QThreadPool::globalInstance()->maxThreadCount());
+    const int chunkSize = qMax(int(MinChunkSize), (end - begin) / (threads * 4) + 1);
+
+    QVector<Chunk<T> > chunks;
+    for (int first = begin; first < end; first += chunkSize) {
+        Chunk<T> chunk = { first, qMin(end, first + chunkSize), initial };
+        chunks.append(chunk);
+    }
+    return chunks;
+}
+
+#endif // ORDEREDMAPCONCURRENT_H
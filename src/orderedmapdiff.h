@@ -0,0 +1,227 @@
+#ifndef ORDEREDMAPDIFF_H
+#define ORDEREDMAPDIFF_H
+
+#include <QtGlobal>
+#include <QDataStream>
+#include <QList>
+#include <QVector>
+
+#include "orderedmap.h"
+
+/* The changes that turn one OrderedMap into another, as computed by diff()
+ * and applied by applyDiff(). Small when the maps mostly agree, so it can be
+ * shipped to a client that holds the older map instead of the whole newer one.
+ *
+ * As many keys as possible keep their place: those in the longest run that
+ * is in the same relative order in both maps. They only carry a new value if
+ * it changed. Every other key that was in the older map is moved, and new
+ * keys are added, each with its index in the newer map, so one key moving
+ * costs one entry however far it moved.
+ */
+template <typename Key, typename Value>
+struct OrderedMapDiff
+{
+    // Keys that are gone, in their old order
+    QList<Key> removed;
+    // Keys that keep their place, with their new value
+    OrderedMap<Key, Value> changed;
+    // Keys that were in the older map but moved, with their value, in their new order
+    OrderedMap<Key, Value> moved;
+    // Index in the newer map of each key in moved
+    QList<int> movedTo;
+    // Keys that are new, in their new order
+    OrderedMap<Key, Value> added;
+    // Index in the newer map of each key in added
+    QList<int> addedAt;
+
+    bool isEmpty() const
+    {
+        return removed.isEmpty() && changed.isEmpty() && moved.isEmpty() && added.isEmpty();
+    }
+};
+
+/* Returns the changes from one map to another in O(n log n), using the
+ * hashes the maps cache rather than hashing keys again. The keys that keep
+ * their place are a longest increasing run of their old positions, taken
+ * in the new order. Maps that still share their data after a copy are known
+ * to be equal without looking at any entry.
+ */
+template <typename Key, typename Value>
+OrderedMapDiff<Key, Value> diff(const OrderedMap<Key, Value> &from, const OrderedMap<Key, Value> &to)
+{
+    typedef typename OrderedMap<Key, Value>::Node Node;
+
+    OrderedMapDiff<Key, Value> result;
+    if (from.nodes.isSharedWith(to.nodes)) {
+        return result;
+    }
+
+    for (int pos = from.firstLive; pos < from.nodes.size(); ++pos) {
+        const Node &node = from.nodes.at(pos);
+        if (node.live && to.findNode(node.key, node.hash) < 0) {
+            result.removed.append(node.key);
+        }
+    }
+
+    // Entries of to that were in from: their positions in both, and their index in to
+    QVector<int> fromPositions;
+    QVector<int> toPositions;
+    QVector<int> indexes;
+    int index = 0;
+    for (int pos = to.firstLive; pos < to.nodes.size(); ++pos) {
+        const Node &node = to.nodes.at(pos);
+        if (!node.live) {
+            continue;
+        }
+        int fromPos = from.findNode(node.key, node.hash);
+        if (fromPos < 0) {
+            result.added.nodes.append(node);
+            result.addedAt.append(index);
+        } else {
+            fromPositions.append(fromPos);
+            toPositions.append(pos);
+            indexes.append(index);
+        }
+        ++index;
+    }
+
+    /* Patience sorting: tails[n] ends the increasing run of length n + 1
+     * whose last old position is smallest, and previous links each entry to
+     * the one before it in the longest run ending there.
+     */
+    const int n = fromPositions.size();
+    QVector<int> tails;
+    QVector<int> previous(n);
+    for (int i = 0; i < n; ++i) {
+        int low = 0;
+        int high = tails.size();
+        while (low < high) {
+            int middle = (low + high) / 2;
+            if (fromPositions.at(tails.at(middle)) < fromPositions.at(i)) {
+                low = middle + 1;
+            } else {
+                high = middle;
+            }
+        }
+        previous[i] = low > 0 ? tails.at(low - 1) : -1;
+        if (low == tails.size()) {
+            tails.append(i);
+        } else {
+            tails[low] = i;
+        }
+    }
+    QVector<bool> kept(n, false);
+    for (int i = tails.isEmpty() ? -1 : tails.last(); i >= 0; i = previous.at(i)) {
+        kept[i] = true;
+    }
+
+    for (int i = 0; i < n; ++i) {
+        const Node &node = to.nodes.at(toPositions.at(i));
+        if (!kept.at(i)) {
+            result.moved.nodes.append(node);
+            result.movedTo.append(indexes.at(i));
+        } else if (!(from.nodes.at(fromPositions.at(i)).value == node.value)) {
+            result.changed.nodes.append(node);
+        }
+    }
+
+    // Keys are unique and hashes cached, so indexing never hashes a key
+    result.changed.linkAppended(0);
+    result.moved.linkAppended(0);
+    result.added.linkAppended(0);
+    return result;
+}
+
+/* Applies changes computed by diff() to the map they were computed from,
+ * after which it equals the newer map. Changed and moved values are written
+ * in place and, like values set through operator[](), are not journaled.
+ * Unless something moved or was added before the end, no entry is moved.
+ */
+template <typename Key, typename Value>
+void applyDiff(OrderedMap<Key, Value> &map, const OrderedMapDiff<Key, Value> &changes)
+{
+    typedef typename OrderedMap<Key, Value>::Node Node;
+
+    for (int i = 0; i < changes.removed.size(); ++i) {
+        map.remove(changes.removed.at(i));
+    }
+
+    const OrderedMap<Key, Value> &changed = changes.changed;
+    for (int pos = changed.firstLive; pos < changed.nodes.size(); ++pos) {
+        const Node &node = changed.nodes.at(pos);
+        if (!node.live) {
+            continue;
+        }
+        int target = map.findNode(node.key, node.hash);
+        if (target >= 0) {
+            map.nodes[target].value = node.value;
+        }
+    }
+
+    for (int pos = changes.added.firstLive; pos < changes.added.nodes.size(); ++pos) {
+        const Node &node = changes.added.nodes.at(pos);
+        if (node.live) {
+            map.insert(node.key, node.value);
+        }
+    }
+
+    /* Moved and added entries go to their index; the rest keep their order
+     * and fill the indexes left over.
+     */
+    const int size = map.size();
+    QVector<int> order(size, -1);
+    QVector<bool> placed(map.nodes.size(), false);
+    const OrderedMap<Key, Value> *placedMaps[] = { &changes.moved, &changes.added };
+    const QList<int> *placedIndexes[] = { &changes.movedTo, &changes.addedAt };
+    for (int m = 0; m < 2; ++m) {
+        const OrderedMap<Key, Value> &entries = *placedMaps[m];
+        int i = 0;
+        for (int pos = entries.firstLive; pos < entries.nodes.size(); ++pos) {
+            const Node &node = entries.nodes.at(pos);
+            if (!node.live) {
+                continue;
+            }
+            int index = placedIndexes[m]->value(i++, -1);
+            int target = map.findNode(node.key, node.hash);
+            if (target < 0 || index < 0 || index >= size || order.at(index) >= 0) {
+                continue;
+            }
+            map.nodes[target].value = node.value;
+            order[index] = target;
+            placed[target] = true;
+        }
+    }
+
+    int index = 0;
+    for (int pos = map.firstLive; pos < map.nodes.size(); ++pos) {
+        if (map.nodes.at(pos).live && !placed.at(pos)) {
+            while (order.at(index) >= 0) {
+                ++index;
+            }
+            order[index] = pos;
+        }
+    }
+
+    for (int i = 1; i < size; ++i) {
+        if (order.at(i) < order.at(i - 1)) {
+            map.permute(order);
+            break;
+        }
+    }
+}
+
+template <typename Key, typename Value>
+QDataStream &operator<<(QDataStream &out, const OrderedMapDiff<Key, Value> &changes)
+{
+    return out << changes.removed << changes.changed << changes.moved << changes.movedTo
+               << changes.added << changes.addedAt;
+}
+
+template <typename Key, typename Value>
+QDataStream &operator>>(QDataStream &in, OrderedMapDiff<Key, Value> &changes)
+{
+    return in >> changes.removed >> changes.changed >> changes.moved >> changes.movedTo
+              >> changes.added >> changes.addedAt;
+}
+
+#endif // ORDEREDMAPDIFF_H
@@ -0,0 +1,213 @@
+#ifndef ORDEREDMAPHASH_H
+#define ORDEREDMAPHASH_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QString>
+#include <QtEndian>
+
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define OM_HASH_SSE2
+#endif
+
+/* A fast hash for byte strings, in the style of wyhash and xxh3: short
+ * inputs are mixed with a couple of 64 x 64 -> 128 bit multiplications, long
+ * ones are accumulated 32 bytes at a time in four independent lanes, which
+ * the compiler cannot otherwise vectorize. With AVX2 all four lanes take one
+ * instruction, with SSE2 two. Every path computes the same lane arithmetic,
+ * so the hash of a key never depends on how the code was built.
+ *
+ * It is not a cryptographic hash and is not seeded per process, so maps fed
+ * with keys from an untrusted source should keep qHash() and its seed.
+ */
+struct OrderedMapHashing
+{
+    static quint64 hash64(const void *data, int size, quint64 seed);
+
+private:
+    // Bytes per stripe of the long input loop, one 64 bit word per lane
+    enum { StripeSize = 32, LongInput = 64 };
+
+    static void accumulate(quint64 *acc, const uchar *p, int stripes);
+
+    static quint64 hashLong(const uchar *p, int size, quint64 seed);
+
+    static quint64 mix(quint64 a, quint64 b);
+
+    static quint64 read32(const uchar *p);
+
+    static quint64 read64(const uchar *p);
+
+    static const quint64 *secret();
+};
+
+inline quint64 OrderedMapHashing::hash64(const void *data, int size, quint64 seed)
+{
+    const quint64 *key = secret();
+    const uchar *p = static_cast<const uchar *>(data);
+    if (size > LongInput) {
+        return hashLong(p, size, seed);
+    }
+
+    seed ^= mix(seed ^ key[0], key[1]);
+    quint64 a;
+    quint64 b;
+    if (size <= 16) {
+        if (size >= 4) {
+            // Two overlapping reads from each end cover 4 to 16 bytes
+            int shift = (size >> 3) << 2;
+            a = (read32(p) << 32) | read32(p + shift);
+            b = (read32(p + size - 4) << 32) | read32(p + size - 4 - shift);
+        } else if (size > 0) {
+            a = (quint64(p[0]) << 16) | (quint64(p[size >> 1]) << 8) | p[size - 1];
+            b = 0;
+        } else {
+            a = 0;
+            b = 0;
+        }
+    } else {
+        // 17 to 64 bytes, 16 at a time, the last 16 overlapping
+        for (int i = 0; size - i > 16; i += 16) {
+            seed = mix(read64(p + i) ^ key[1], read64(p + i + 8) ^ seed);
+        }
+        a = read64(p + size - 16);
+        b = read64(p + size - 8);
+    }
+    return mix(key[1] ^ quint64(size), mix(a ^ key[1], b ^ seed));
+}
+
+/* Adds stripes of 32 bytes to the four lane accumulators. Each lane adds
+ * the product of the low and high halves of its word, keyed with the secret,
+ * plus the neighbouring lane's word as it is, so no input bit gets lost.
+ */
+inline void OrderedMapHashing::accumulate(quint64 *acc, const uchar *p, int stripes)
+{
+#if defined(__AVX2__)
+    __m256i sum = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(acc));
+    const __m256i key = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(secret()));
+    for (int i = 0; i < stripes; ++i, p += StripeSize) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i keyed = _mm256_xor_si256(data, key);
+        __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+        __m256i swapped = _mm256_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+        sum = _mm256_add_epi64(sum, _mm256_add_epi64(product, swapped));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(acc), sum);
+#elif defined(OM_HASH_SSE2)
+    __m128i sum[2];
+    __m128i key[2];
+    for (int half = 0; half < 2; ++half) {
+        sum[half] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(acc + 2 * half));
+        key[half] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(secret() + 2 * half));
+    }
+    for (int i = 0; i < stripes; ++i, p += StripeSize) {
+        for (int half = 0; half < 2; ++half) {
+            __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p + 16 * half));
+            __m128i keyed = _mm_xor_si128(data, key[half]);
+            __m128i product = _mm_mul_epu32(keyed, _mm_srli_epi64(keyed, 32));
+            __m128i swapped = _mm_shuffle_epi32(data, _MM_SHUFFLE(1, 0, 3, 2));
+            sum[half] = _mm_add_epi64(sum[half], _mm_add_epi64(product, swapped));
+        }
+    }
+    for (int half = 0; half < 2; ++half) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(acc + 2 * half), sum[half]);
+    }
+#else
+    const quint64 *key = secret();
+    for (int i = 0; i < stripes; ++i, p += StripeSize) {
+        quint64 data[4];
+        for (int lane = 0; lane < 4; ++lane) {
+            data[lane] = read64(p + 8 * lane);
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+            quint64 keyed = data[lane] ^ key[lane];
+            acc[lane] += (keyed & 0xffffffffu) * (keyed >> 32) + data[lane ^ 1];
+        }
+    }
+#endif
+}
+
+inline quint64 OrderedMapHashing::hashLong(const uchar *p, int size, quint64 seed)
+{
+    const quint64 *key = secret();
+    quint64 acc[4] = { seed, seed ^ key[4], seed + key[5], seed - key[4] };
+    accumulate(acc, p, (size - 1) / StripeSize);
+    // The last stripe ends at the last byte, overlapping the one before
+    accumulate(acc, p + size - StripeSize, 1);
+
+    quint64 result = quint64(size) * key[0];
+    result ^= mix(acc[0] ^ key[1], acc[1] ^ key[2]);
+    result ^= mix(acc[2] ^ key[3], acc[3] ^ key[4]);
+    return mix(result ^ key[0], (result >> 29) ^ key[5]);
+}
+
+// Folds the 128 bit product of a and b into 64 bits
+inline quint64 OrderedMapHashing::mix(quint64 a, quint64 b)
+{
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = static_cast<__uint128_t>(a) * b;
+    return quint64(product) ^ quint64(product >> 64);
+#else
+    quint64 aLow = quint32(a), aHigh = a >> 32;
+    quint64 bLow = quint32(b), bHigh = b >> 32;
+    quint64 low = aLow * bLow;
+    quint64 middle1 = aHigh * bLow;
+    quint64 middle2 = aLow * bHigh;
+    quint64 high = aHigh * bHigh;
+    quint64 carry = ((low >> 32) + quint32(middle1) + quint32(middle2)) >> 32;
+    quint64 productLow = low + (middle1 << 32) + (middle2 << 32);
+    quint64 productHigh = high + (middle1 >> 32) + (middle2 >> 32) + carry;
+    return productLow ^ productHigh;
+#endif
+}
+
+inline quint64 OrderedMapHashing::read32(const uchar *p)
+{
+    return qFromLittleEndian<quint32>(p);
+}
+
+inline quint64 OrderedMapHashing::read64(const uchar *p)
+{
+    return qFromLittleEndian<quint64>(p);
+}
+
+// Lanes 0 to 3 key the stripes, in the order they are loaded in
+inline const quint64 *OrderedMapHashing::secret()
+{
+    static const quint64 values[6] = {
+        Q_UINT64_C(0xa0761d6478bd642f), Q_UINT64_C(0xe7037ed1a0b428db),
+        Q_UINT64_C(0x8ebc6af09c88c6e3), Q_UINT64_C(0x589965cc75374cc3),
+        Q_UINT64_C(0x1d8e4e27c47d124f), Q_UINT64_C(0xc2b2ae3d27d4eb4f)
+    };
+    return values;
+}
+
+inline uint oMHashBytes(const void *data, int size, uint seed = 0)
+{
+    quint64 hash = OrderedMapHashing::hash64(data, size, seed);
+    return uint(hash ^ (hash >> 32));
+}
+
+/* Drop-in Hash for OrderedMap with QByteArray or QString keys, eg.
+ * OrderedMap<QByteArray, int, OrderedMapFastHash>. QStrings are hashed as
+ * their UTF-16 bytes, without conversion.
+ */
+struct OrderedMapFastHash
+{
+    uint operator()(const QByteArray &key) const
+    {
+        return oMHashBytes(key.constData(), key.size());
+    }
+
+    uint operator()(const QString &key) const
+    {
+        return oMHashBytes(key.constData(), int(key.size() * sizeof(QChar)));
+    }
+};
+
+#endif // ORDEREDMAPHASH_H
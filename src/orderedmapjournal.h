@@ -0,0 +1,220 @@
+#ifndef ORDEREDMAPJOURNAL_H
+#define ORDEREDMAPJOURNAL_H
+
+#include <QtGlobal>
+#include <QDataStream>
+#include <QVector>
+
+#include "orderedmap.h"
+
+/* Records the changes made to an OrderedMap, so they can be persisted or
+ * shipped to a replica incrementally instead of re-serializing the map.
+ *
+ * Attach a journal with OrderedMap::setJournal(). Every insert(), remove(),
+ * take(), erase() and clear() made through the map is then appended with a
+ * sequence number. drain() writes the pending changes as one batch and
+ * discards them; replay() applies such a batch to another map.
+ *
+ * Values changed in place, through operator[]() or an iterator's value(),
+ * bypass the map and are not recorded. Use insert() on journaled maps.
+ */
+template <typename Key, typename Value>
+class OrderedMapJournal
+{
+public:
+    enum Operation {
+        Insert,     // new key appended with a value
+        Overwrite,  // existing key given a new value and moved to the end
+        Move,       // existing key moved to the end, value unchanged
+        Remove,
+        Clear
+    };
+
+    struct Entry
+    {
+        quint64 sequence;
+        Operation operation;
+        Key key;
+        Value value;
+    };
+
+    OrderedMapJournal();
+
+    void clear();
+
+    int count() const;
+
+    void drain(QDataStream &out);
+
+    const QVector<Entry> &entries() const;
+
+    bool isEmpty() const;
+
+    quint64 lastSequence() const;
+
+    int size() const;
+
+    template <typename Hash, typename Equal>
+    static bool replay(QDataStream &in, OrderedMap<Key, Value, Hash, Equal> &map, quint64 *lastApplied = NULL);
+
+private:
+    template <typename K, typename V, typename H, typename E>
+    friend class OrderedMap;
+
+    void record(Operation operation, const Key &key = Key(), const Value &value = Value());
+
+    QVector<Entry> pending;
+    quint64 sequence;
+};
+
+template <typename Key, typename Value>
+OrderedMapJournal<Key, Value>::OrderedMapJournal() : sequence(0) {}
+
+template <typename Key, typename Value>
+void OrderedMapJournal<Key, Value>::clear()
+{
+    pending.clear();
+}
+
+template <typename Key, typename Value>
+int OrderedMapJournal<Key, Value>::count() const
+{
+    return pending.size();
+}
+
+/* Each batch is the number of entries followed by the entries themselves.
+ * Sequence numbers keep increasing across batches.
+ */
+template <typename Key, typename Value>
+void OrderedMapJournal<Key, Value>::drain(QDataStream &out)
+{
+    out << quint32(pending.size());
+    for (int i = 0; i < pending.size(); ++i) {
+        const Entry &entry = pending.at(i);
+        out << entry.sequence << quint8(entry.operation);
+        switch (entry.operation) {
+        case Insert:
+        case Overwrite:
+            out << entry.key << entry.value;
+            break;
+        case Move:
+        case Remove:
+            out << entry.key;
+            break;
+        case Clear:
+            break;
+        }
+    }
+    pending.clear();
+}
+
+template <typename Key, typename Value>
+const QVector<typename OrderedMapJournal<Key, Value>::Entry> &OrderedMapJournal<Key, Value>::entries() const
+{
+    return pending;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapJournal<Key, Value>::isEmpty() const
+{
+    return pending.isEmpty();
+}
+
+template <typename Key, typename Value>
+quint64 OrderedMapJournal<Key, Value>::lastSequence() const
+{
+    return sequence;
+}
+
+template <typename Key, typename Value>
+int OrderedMapJournal<Key, Value>::size() const
+{
+    return pending.size();
+}
+
+/* Applies one batch written by drain() to map. If lastApplied is given,
+ * entries up to and including that sequence number are skipped, so a
+ * replica restored from a checkpoint can replay a journal that overlaps it.
+ * It is updated to the last sequence number applied.
+ *
+ * Returns false if the stream is corrupt or ends early; entries before the
+ * error have been applied.
+ */
+template <typename Key, typename Value>
+template <typename Hash, typename Equal>
+bool OrderedMapJournal<Key, Value>::replay(QDataStream &in, OrderedMap<Key, Value, Hash, Equal> &map, quint64 *lastApplied)
+{
+    quint32 n;
+    in >> n;
+
+    for (quint32 i = 0; i < n; ++i) {
+        if (in.status() != QDataStream::Ok) {
+            return false;
+        }
+
+        quint64 sequence;
+        quint8 operation;
+        Key key;
+        Value value;
+        in >> sequence >> operation;
+
+        switch (operation) {
+        case Insert:
+        case Overwrite:
+            in >> key >> value;
+            break;
+        case Move:
+        case Remove:
+            in >> key;
+            break;
+        case Clear:
+            break;
+        default:
+            in.setStatus(QDataStream::ReadCorruptData);
+            return false;
+        }
+
+        if (in.status() != QDataStream::Ok) {
+            return false;
+        }
+        if (lastApplied && sequence <= *lastApplied) {
+            continue;
+        }
+
+        switch (operation) {
+        case Insert:
+        case Overwrite:
+            map.insert(key, value);
+            break;
+        case Move:
+            if (map.contains(key)) {
+                map.insert(key, map.value(key));
+            }
+            break;
+        case Remove:
+            map.remove(key);
+            break;
+        case Clear:
+            map.clear();
+            break;
+        }
+
+        if (lastApplied) {
+            *lastApplied = sequence;
+        }
+    }
+    return in.status() == QDataStream::Ok;
+}
+
+template <typename Key, typename Value>
+void OrderedMapJournal<Key, Value>::record(Operation operation, const Key &key, const Value &value)
+{
+    Entry entry;
+    entry.sequence = ++sequence;
+    entry.operation = operation;
+    entry.key = key;
+    entry.value = value;
+    pending.append(entry);
+}
+
+#endif // ORDEREDMAPJOURNAL_H
@@ -0,0 +1,714 @@
+#ifndef ORDEREDMAPVIEW_H
+#define ORDEREDMAPVIEW_H
+
+#include <QtGlobal>
+#include <QByteArray>
+#include <QFile>
+#include <QIODevice>
+#include <QString>
+#include <QVarLengthArray>
+#include <QVector>
+
+#include <limits.h>
+#include <string.h>
+
+#include <limits>
+
+#include "orderedmap.h"
+
+/* Identifies a bytewise-copyable type in a snapshot header: the kind of
+ * number it is, if any, and its size, so that a snapshot of int values does
+ * not open as a view of float or uint ones. Structs all share the same kind,
+ * so specialize this for those that have the same size.
+ */
+template <typename T>
+struct OrderedMapViewTypeTag
+{
+    enum {
+        Kind = !std::numeric_limits<T>::is_specialized ? 0
+               : std::numeric_limits<T>::digits == 1 ? 4
+               : !std::numeric_limits<T>::is_integer ? 3
+               : std::numeric_limits<T>::is_signed ? 1 : 2,
+        Value = (Kind << 24) | int(sizeof(T))
+    };
+};
+
+/* Describes how a key or value type is laid out in an OrderedMapView
+ * snapshot. The default handles types that can be copied bytewise; QString
+ * and QByteArray are stored length-prefixed and are read back without
+ * copying their contents out of the mapping.
+ *
+ * Keys are hashed and compared on their stored bytes, so two keys that are
+ * operator==() equal but differ bytewise (padding, -0.0 vs 0.0) are
+ * different keys in a snapshot.
+ */
+template <typename T>
+struct OrderedMapViewTraits
+{
+    Q_STATIC_ASSERT_X(!QTypeInfo<T>::isComplex,
+                      "OrderedMapView supports bytewise-copyable types, QString and QByteArray");
+
+    enum { Tag = OrderedMapViewTypeTag<T>::Value };
+
+    static int size(const T &)
+    {
+        return sizeof(T);
+    }
+
+    // Whether a field stored at in, with available bytes after it, is whole
+    static bool fits(const uchar *, quint64 available)
+    {
+        return available >= sizeof(T);
+    }
+
+    static void write(char *out, const T &t)
+    {
+        memcpy(out, &t, sizeof(T));
+    }
+
+    static int storedSize(const uchar *)
+    {
+        return sizeof(T);
+    }
+
+    static T read(const uchar *in)
+    {
+        T t;
+        memcpy(&t, in, sizeof(T));
+        return t;
+    }
+};
+
+template <>
+struct OrderedMapViewTraits<QByteArray>
+{
+    enum { Tag = 0x7fff0001 };
+
+    static int size(const QByteArray &t)
+    {
+        return sizeof(quint32) + t.size();
+    }
+
+    static void write(char *out, const QByteArray &t)
+    {
+        quint32 length = t.size();
+        memcpy(out, &length, sizeof(quint32));
+        memcpy(out + sizeof(quint32), t.constData(), t.size());
+    }
+
+    static bool fits(const uchar *in, quint64 available)
+    {
+        quint32 length;
+        memcpy(&length, in, sizeof(quint32));
+        return available >= sizeof(quint32) + quint64(length);
+    }
+
+    static int storedSize(const uchar *in)
+    {
+        quint32 length;
+        memcpy(&length, in, sizeof(quint32));
+        return sizeof(quint32) + length;
+    }
+
+    static QByteArray read(const uchar *in)
+    {
+        return QByteArray::fromRawData(reinterpret_cast<const char *>(in) + sizeof(quint32),
+                                       storedSize(in) - sizeof(quint32));
+    }
+};
+
+template <>
+struct OrderedMapViewTraits<QString>
+{
+    enum { Tag = 0x7fff0002 };
+
+    // Stored as the length in QChars followed by UTF-16 data
+    static int size(const QString &t)
+    {
+        return sizeof(quint32) + t.size() * sizeof(QChar);
+    }
+
+    static void write(char *out, const QString &t)
+    {
+        quint32 length = t.size();
+        memcpy(out, &length, sizeof(quint32));
+        memcpy(out + sizeof(quint32), t.unicode(), t.size() * sizeof(QChar));
+    }
+
+    static bool fits(const uchar *in, quint64 available)
+    {
+        quint32 length;
+        memcpy(&length, in, sizeof(quint32));
+        return available >= sizeof(quint32) + quint64(length) * sizeof(QChar);
+    }
+
+    static int storedSize(const uchar *in)
+    {
+        quint32 length;
+        memcpy(&length, in, sizeof(quint32));
+        return sizeof(quint32) + length * sizeof(QChar);
+    }
+
+    static QString read(const uchar *in)
+    {
+        // Fields start 4-byte aligned, so the UTF-16 data is suitably aligned
+        return QString::fromRawData(reinterpret_cast<const QChar *>(in + sizeof(quint32)),
+                                    (storedSize(in) - sizeof(quint32)) / sizeof(QChar));
+    }
+};
+
+/* A read-only OrderedMap backed by a flat, position-independent snapshot
+ * file, usually memory mapped. Opening a snapshot checks in one pass that
+ * its tables and entries lie within the data, without copying anything out;
+ * lookups and iteration then read straight from the mapped bytes.
+ *
+ * File layout, in host byte order:
+ *
+ *   header
+ *   quint64 offsets[count]        entry offsets, in insertion order
+ *   Slot index[indexCapacity]     open-addressed, linear probing
+ *   entries                       key field, value field, each 4-aligned
+ *
+ * Snapshots are created with write() from an OrderedMap. QString and
+ * QByteArray keys and values returned by a view point into the mapping and
+ * must not be used after the view is closed.
+ */
+template <typename Key, typename Value>
+class OrderedMapView
+{
+    typedef OrderedMapViewTraits<Key> KeyTraits;
+    typedef OrderedMapViewTraits<Value> ValueTraits;
+
+    struct Header
+    {
+        char magic[8];
+        quint32 version;
+        quint32 byteOrder;
+        quint32 keyTag;
+        quint32 valueTag;
+        quint64 count;
+        quint64 indexCapacity;
+        quint64 offsetsOffset;
+        quint64 indexOffset;
+        quint64 entriesOffset;
+        quint64 fileSize;
+    };
+
+    struct Slot
+    {
+        quint32 hash;
+        quint32 entry; // entry number + 1, 0 if the slot is empty
+    };
+
+public:
+
+    class const_iterator;
+
+    typedef typename OrderedMapView<Key, Value>::const_iterator ConstIterator;
+
+    OrderedMapView();
+
+    ~OrderedMapView();
+
+    bool open(const QString &fileName);
+
+    bool setRawData(const uchar *data, qint64 size);
+
+    void close();
+
+    bool isOpen() const;
+
+    bool contains(const Key &key) const;
+
+    int count() const;
+
+    bool empty() const;
+
+    bool isEmpty() const;
+
+    Key keyAt(int i) const;
+
+    int size() const;
+
+    Value value(const Key &key) const;
+
+    Value value(const Key &key, const Value &defaultValue) const;
+
+    Value valueAt(int i) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    const_iterator find(const Key &key) const;
+
+    static bool write(const OrderedMap<Key, Value> &map, QIODevice *device);
+
+    static bool write(const OrderedMap<Key, Value> &map, const QString &fileName);
+
+    class const_iterator
+    {
+        const OrderedMapView *view;
+        int i;
+
+    public:
+        const_iterator() : view(NULL), i(0) {}
+
+        const_iterator(const OrderedMapView *view, int i) : view(view), i(i) {}
+
+        Key key() const
+        {
+            return view->keyAt(i);
+        }
+
+        Value value() const
+        {
+            return view->valueAt(i);
+        }
+
+        Value operator*() const
+        {
+            return value();
+        }
+
+        const_iterator operator+(int j) const
+        {
+            return const_iterator(view, i + j);
+        }
+
+        const_iterator operator-(int j) const
+        {
+            return const_iterator(view, i - j);
+        }
+
+        const_iterator& operator+=(int j)
+        {
+            i += j;
+            return *this;
+        }
+
+        const_iterator& operator-=(int j)
+        {
+            i -= j;
+            return *this;
+        }
+
+        const_iterator& operator++()
+        {
+            ++i;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator it = *this;
+            ++i;
+            return it;
+        }
+
+        const_iterator& operator--()
+        {
+            --i;
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            const_iterator it = *this;
+            --i;
+            return it;
+        }
+
+        bool operator ==(const const_iterator &other) const
+        {
+            return (i == other.i);
+        }
+
+        bool operator !=(const const_iterator &other) const
+        {
+            return (i != other.i);
+        }
+    };
+
+private:
+    Q_DISABLE_COPY(OrderedMapView)
+
+    enum { Version = 2, ByteOrderMark = 0x01020304 };
+
+    static quint32 hashBytes(const uchar *bytes, int length);
+
+    static int align(int size)
+    {
+        return (size + 3) & ~3;
+    }
+
+    const uchar *entry(int i) const;
+
+    static bool validTables(const uchar *data, quint64 size);
+
+    int indexOf(const Key &key) const;
+
+    QFile file;
+    const uchar *base;
+    const Header *header;
+    const quint64 *offsets;
+    const Slot *index;
+    int n;
+};
+
+template <typename Key, typename Value>
+OrderedMapView<Key, Value>::OrderedMapView() :
+    base(NULL), header(NULL), offsets(NULL), index(NULL), n(0) {}
+
+template <typename Key, typename Value>
+OrderedMapView<Key, Value>::~OrderedMapView()
+{
+    close();
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::open(const QString &fileName)
+{
+    close();
+
+    file.setFileName(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    qint64 fileSize = file.size();
+    uchar *mapped = fileSize > 0 ? file.map(0, fileSize) : NULL;
+    if (!mapped || !setRawData(mapped, fileSize)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::setRawData(const uchar *data, qint64 size)
+{
+    base = NULL;
+    header = NULL;
+    offsets = NULL;
+    index = NULL;
+    n = 0;
+
+    if (!data || size < qint64(sizeof(Header)) || (quintptr(data) % sizeof(quint64)) != 0) {
+        return false;
+    }
+
+    const Header *h = reinterpret_cast<const Header *>(data);
+    if (memcmp(h->magic, "OMVIEW\0\0", sizeof(h->magic)) != 0
+            || h->version != Version
+            || h->byteOrder != ByteOrderMark
+            || h->keyTag != quint32(KeyTraits::Tag)
+            || h->valueTag != quint32(ValueTraits::Tag)
+            || h->fileSize != quint64(size)
+            || h->count > quint64(INT_MAX)
+            || h->indexCapacity <= h->count
+            || h->indexCapacity > quint64(size) / sizeof(Slot)
+            || (h->indexCapacity & (h->indexCapacity - 1)) != 0) {
+        return false;
+    }
+
+    // Tables must lie inside the data, in the order they are written
+    if (h->offsetsOffset < sizeof(Header)
+            || h->offsetsOffset > quint64(size)
+            || h->indexOffset > quint64(size)
+            || h->offsetsOffset % sizeof(quint64) != 0
+            || h->indexOffset < h->offsetsOffset + h->count * sizeof(quint64)
+            || h->indexOffset % sizeof(quint64) != 0
+            || h->entriesOffset < h->indexOffset + h->indexCapacity * sizeof(Slot)
+            || h->entriesOffset > quint64(size)
+            || !validTables(data, quint64(size))) {
+        return false;
+    }
+
+    base = data;
+    header = h;
+    offsets = reinterpret_cast<const quint64 *>(data + h->offsetsOffset);
+    index = reinterpret_cast<const Slot *>(data + h->indexOffset);
+    n = int(h->count);
+    return true;
+}
+
+/* Offsets must be ascending, so that entries cannot overlap, and every key
+ * and value field must end before the next entry. Index slots must name
+ * existing entries, and leave at least one slot empty so probing ends.
+ */
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::validTables(const uchar *data, quint64 size)
+{
+    const Header *h = reinterpret_cast<const Header *>(data);
+    const quint64 *offsets = reinterpret_cast<const quint64 *>(data + h->offsetsOffset);
+    const Slot *index = reinterpret_cast<const Slot *>(data + h->indexOffset);
+
+    quint64 used = 0;
+    for (quint64 slot = 0; slot < h->indexCapacity; ++slot) {
+        if (index[slot].entry > h->count) {
+            return false;
+        }
+        used += index[slot].entry != 0;
+    }
+    if (used != h->count) {
+        return false;
+    }
+
+    quint64 previous = h->entriesOffset;
+    for (quint64 i = 0; i < h->count; ++i) {
+        quint64 offset = offsets[i];
+        quint64 end = i + 1 < h->count ? offsets[i + 1] : size;
+        // Every field takes at least 4 bytes, so both length prefixes can be read
+        if (offset < previous || offset % 4 != 0 || end > size || end < offset + 8) {
+            return false;
+        }
+        const uchar *e = data + offset;
+        if (!KeyTraits::fits(e, end - offset)) {
+            return false;
+        }
+        quint64 keySize = align(KeyTraits::storedSize(e));
+        if (end - offset < keySize + 4 || !ValueTraits::fits(e + keySize, end - offset - keySize)) {
+            return false;
+        }
+        previous = end;
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+void OrderedMapView<Key, Value>::close()
+{
+    base = NULL;
+    header = NULL;
+    offsets = NULL;
+    index = NULL;
+    n = 0;
+    file.close();
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::isOpen() const
+{
+    return header != NULL;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::contains(const Key &key) const
+{
+    return indexOf(key) >= 0;
+}
+
+template <typename Key, typename Value>
+int OrderedMapView<Key, Value>::count() const
+{
+    return n;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::empty() const
+{
+    return n == 0;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::isEmpty() const
+{
+    return n == 0;
+}
+
+template <typename Key, typename Value>
+Key OrderedMapView<Key, Value>::keyAt(int i) const
+{
+    Q_ASSERT(i >= 0 && i < n);
+    return KeyTraits::read(entry(i));
+}
+
+template <typename Key, typename Value>
+int OrderedMapView<Key, Value>::size() const
+{
+    return n;
+}
+
+template <typename Key, typename Value>
+Value OrderedMapView<Key, Value>::value(const Key &key) const
+{
+    int i = indexOf(key);
+    if (i < 0) {
+        return Value();
+    }
+    return valueAt(i);
+}
+
+template <typename Key, typename Value>
+Value OrderedMapView<Key, Value>::value(const Key &key, const Value &defaultValue) const
+{
+    int i = indexOf(key);
+    if (i < 0) {
+        return defaultValue;
+    }
+    return valueAt(i);
+}
+
+template <typename Key, typename Value>
+Value OrderedMapView<Key, Value>::valueAt(int i) const
+{
+    Q_ASSERT(i >= 0 && i < n);
+    const uchar *e = entry(i);
+    return ValueTraits::read(e + align(KeyTraits::storedSize(e)));
+}
+
+template <typename Key, typename Value>
+typename OrderedMapView<Key, Value>::const_iterator OrderedMapView<Key, Value>::begin() const
+{
+    return const_iterator(this, 0);
+}
+
+template <typename Key, typename Value>
+typename OrderedMapView<Key, Value>::const_iterator OrderedMapView<Key, Value>::end() const
+{
+    return const_iterator(this, n);
+}
+
+template <typename Key, typename Value>
+typename OrderedMapView<Key, Value>::const_iterator OrderedMapView<Key, Value>::find(const Key &key) const
+{
+    int i = indexOf(key);
+    if (i < 0) {
+        return end();
+    }
+    return const_iterator(this, i);
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::write(const OrderedMap<Key, Value> &map, QIODevice *device)
+{
+    typedef typename OrderedMap<Key, Value>::const_iterator MapIterator;
+
+    quint64 count = map.size();
+    quint64 indexCapacity = 8;
+    // Keep the load factor at or below one half
+    while (indexCapacity < count * 2) {
+        indexCapacity <<= 1;
+    }
+
+    Header h;
+    memset(&h, 0, sizeof(Header));
+    memcpy(h.magic, "OMVIEW\0\0", sizeof(h.magic));
+    h.version = Version;
+    h.byteOrder = ByteOrderMark;
+    h.keyTag = KeyTraits::Tag;
+    h.valueTag = ValueTraits::Tag;
+    h.count = count;
+    h.indexCapacity = indexCapacity;
+    h.offsetsOffset = sizeof(Header);
+    h.indexOffset = h.offsetsOffset + count * sizeof(quint64);
+    h.entriesOffset = h.indexOffset + indexCapacity * sizeof(Slot);
+
+    // First pass lays out the entries and builds the index
+    QVector<quint64> offsets;
+    offsets.reserve(count);
+    QVector<Slot> index(indexCapacity);
+    memset(index.data(), 0, indexCapacity * sizeof(Slot));
+
+    QVarLengthArray<char, 256> keyBytes;
+    quint64 offset = h.entriesOffset;
+    quint32 entry = 0;
+    for (MapIterator it = map.begin(); it != map.end(); ++it) {
+        offsets.append(offset);
+
+        int keySize = KeyTraits::size(it.key());
+        keyBytes.resize(keySize);
+        KeyTraits::write(keyBytes.data(), it.key());
+        quint32 hash = hashBytes(reinterpret_cast<const uchar *>(keyBytes.constData()), keySize);
+
+        quint64 slot = hash & (indexCapacity - 1);
+        while (index[slot].entry != 0) {
+            slot = (slot + 1) & (indexCapacity - 1);
+        }
+        index[slot].hash = hash;
+        index[slot].entry = ++entry;
+
+        offset += align(keySize) + align(ValueTraits::size(it.value()));
+    }
+    h.fileSize = offset;
+
+    if (device->write(reinterpret_cast<const char *>(&h), sizeof(Header)) != qint64(sizeof(Header))
+            || device->write(reinterpret_cast<const char *>(offsets.constData()), count * sizeof(quint64))
+                    != qint64(count * sizeof(quint64))
+            || device->write(reinterpret_cast<const char *>(index.constData()), indexCapacity * sizeof(Slot))
+                    != qint64(indexCapacity * sizeof(Slot))) {
+        return false;
+    }
+
+    // Second pass writes the entries
+    QByteArray record;
+    for (MapIterator it = map.begin(); it != map.end(); ++it) {
+        int keySize = align(KeyTraits::size(it.key()));
+        int valueSize = align(ValueTraits::size(it.value()));
+        record.fill('\0', keySize + valueSize);
+        KeyTraits::write(record.data(), it.key());
+        ValueTraits::write(record.data() + keySize, it.value());
+        if (device->write(record) != record.size()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+bool OrderedMapView<Key, Value>::write(const OrderedMap<Key, Value> &map, const QString &fileName)
+{
+    QFile out(fileName);
+    if (!out.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        return false;
+    }
+    return write(map, &out);
+}
+
+template <typename Key, typename Value>
+quint32 OrderedMapView<Key, Value>::hashBytes(const uchar *bytes, int length)
+{
+    // FNV-1a, so snapshots hash the same in every process and Qt version
+    quint32 hash = 2166136261u;
+    for (int i = 0; i < length; ++i) {
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+template <typename Key, typename Value>
+const uchar *OrderedMapView<Key, Value>::entry(int i) const
+{
+    return base + offsets[i];
+}
+
+template <typename Key, typename Value>
+int OrderedMapView<Key, Value>::indexOf(const Key &key) const
+{
+    if (n == 0) {
+        return -1;
+    }
+
+    int keySize = KeyTraits::size(key);
+    QVarLengthArray<char, 256> keyBytes(keySize);
+    KeyTraits::write(keyBytes.data(), key);
+    const uchar *bytes = reinterpret_cast<const uchar *>(keyBytes.constData());
+    quint32 hash = hashBytes(bytes, keySize);
+
+    quint64 mask = header->indexCapacity - 1;
+    for (quint64 slot = hash & mask; index[slot].entry != 0; slot = (slot + 1) & mask) {
+        if (index[slot].hash != hash) {
+            continue;
+        }
+        int i = index[slot].entry - 1;
+        const uchar *e = entry(i);
+        if (KeyTraits::storedSize(e) == keySize && memcmp(e, bytes, keySize) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+#endif // ORDEREDMAPVIEW_H
@@ -0,0 +1,319 @@
+#ifndef ORDEREDSET_H
+#define ORDEREDSET_H
+
+#include <QtGlobal>
+#include <QDataStream>
+#include <QList>
+
+#include "orderedmap.h"
+
+#ifdef Q_COMPILER_INITIALIZER_LISTS
+#include <initializer_list>
+#endif
+
+/* The value type of the OrderedMap behind an OrderedSet. It is empty, and
+ * OrderedMap places the value in padding, so set entries take no more space
+ * than a key with its cached hash.
+ */
+struct OrderedSetNoValue
+{
+    bool operator==(const OrderedSetNoValue &) const
+    {
+        return true;
+    }
+
+    bool operator!=(const OrderedSetNoValue &) const
+    {
+        return false;
+    }
+};
+
+inline QDataStream &operator<<(QDataStream &out, const OrderedSetNoValue &)
+{
+    return out;
+}
+
+inline QDataStream &operator>>(QDataStream &in, OrderedSetNoValue &)
+{
+    return in;
+}
+
+/* A set of keys that remembers the order they were first inserted in.
+ *
+ * Unlike OrderedMap::insert(), inserting a key that is already present does
+ * not move it; the set keeps the first occurrence, which is what
+ * deduplicating a stream needs. unite(), intersect() and subtract() keep the
+ * order of this set, with keys added by unite() appended in the other set's
+ * order.
+ */
+template <typename Key>
+class OrderedSet
+{
+    typedef OrderedMap<Key, OrderedSetNoValue> Map;
+
+public:
+    typedef typename Map::key_iterator const_iterator;
+    typedef const_iterator iterator;
+    typedef const_iterator ConstIterator;
+    typedef const_iterator Iterator;
+
+    OrderedSet();
+
+#ifdef Q_COMPILER_INITIALIZER_LISTS
+    OrderedSet(std::initializer_list<Key> list);
+#endif
+
+    const Key &at(int i) const;
+
+    void clear();
+
+    bool contains(const Key &key) const;
+
+    int count() const;
+
+    bool empty() const;
+
+    int indexOf(const Key &key) const;
+
+    bool insert(const Key &key);
+
+    OrderedSet<Key> &intersect(const OrderedSet<Key> &other);
+
+    bool isEmpty() const;
+
+    bool remove(const Key &key);
+
+    void reserve(int size);
+
+    int size() const;
+
+    void squeeze();
+
+    OrderedSet<Key> &subtract(const OrderedSet<Key> &other);
+
+    QList<Key> toList() const;
+
+    OrderedSet<Key> &unite(const OrderedSet<Key> &other);
+
+    QList<Key> values() const;
+
+    bool operator==(const OrderedSet<Key> &other) const;
+
+    bool operator!=(const OrderedSet<Key> &other) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+private:
+    template <typename K>
+    friend QDataStream &operator<<(QDataStream &out, const OrderedSet<K> &set);
+
+    // Selects the keys that are (or are not) in another set, for removeIf()
+    class InSet
+    {
+        const OrderedSet<Key> *set;
+        bool wanted;
+
+    public:
+        InSet(const OrderedSet<Key> *set, bool wanted) :
+            set(set), wanted(wanted) {}
+
+        bool operator()(const Key &key, const OrderedSetNoValue &) const
+        {
+            return set->contains(key) == wanted;
+        }
+    };
+
+    Map map;
+};
+
+template <typename Key>
+OrderedSet<Key>::OrderedSet() {}
+
+#ifdef Q_COMPILER_INITIALIZER_LISTS
+template <typename Key>
+OrderedSet<Key>::OrderedSet(std::initializer_list<Key> list)
+{
+    typedef typename std::initializer_list<Key>::const_iterator const_initlist_iter;
+    map.reserve(int(list.size()));
+    for (const_initlist_iter it = list.begin(); it != list.end(); ++it)
+        insert(*it);
+}
+#endif
+
+template <typename Key>
+const Key &OrderedSet<Key>::at(int i) const
+{
+    return map.keyAt(i);
+}
+
+template <typename Key>
+void OrderedSet<Key>::clear()
+{
+    map.clear();
+}
+
+template <typename Key>
+bool OrderedSet<Key>::contains(const Key &key) const
+{
+    return map.contains(key);
+}
+
+template <typename Key>
+int OrderedSet<Key>::count() const
+{
+    return map.count();
+}
+
+template <typename Key>
+bool OrderedSet<Key>::empty() const
+{
+    return map.empty();
+}
+
+template <typename Key>
+int OrderedSet<Key>::indexOf(const Key &key) const
+{
+    return map.indexOf(key);
+}
+
+// Returns true if key was not in the set before
+template <typename Key>
+bool OrderedSet<Key>::insert(const Key &key)
+{
+    return map.insertNew(key, OrderedSetNoValue());
+}
+
+// Removes the keys that are not in other, in one pass
+template <typename Key>
+OrderedSet<Key> &OrderedSet<Key>::intersect(const OrderedSet<Key> &other)
+{
+    if (&other != this) {
+        map.removeIf(InSet(&other, false));
+    }
+    return *this;
+}
+
+template <typename Key>
+bool OrderedSet<Key>::isEmpty() const
+{
+    return map.isEmpty();
+}
+
+template <typename Key>
+bool OrderedSet<Key>::remove(const Key &key)
+{
+    return map.remove(key) != 0;
+}
+
+template <typename Key>
+void OrderedSet<Key>::reserve(int size)
+{
+    map.reserve(size);
+}
+
+template <typename Key>
+int OrderedSet<Key>::size() const
+{
+    return map.size();
+}
+
+template <typename Key>
+void OrderedSet<Key>::squeeze()
+{
+    map.squeeze();
+}
+
+template <typename Key>
+OrderedSet<Key> &OrderedSet<Key>::subtract(const OrderedSet<Key> &other)
+{
+    if (&other == this) {
+        clear();
+    } else if (other.size() < size() / 4) {
+        // Cheaper to look up each of other's keys than to sweep this set
+        for (const_iterator it = other.begin(); it != other.end(); ++it) {
+            map.remove(*it);
+        }
+    } else {
+        map.removeIf(InSet(&other, true));
+    }
+    return *this;
+}
+
+template <typename Key>
+QList<Key> OrderedSet<Key>::toList() const
+{
+    return map.keys();
+}
+
+// Appends the keys of other that are not in this set yet, in other's order
+template <typename Key>
+OrderedSet<Key> &OrderedSet<Key>::unite(const OrderedSet<Key> &other)
+{
+    map.unite(other.map);
+    return *this;
+}
+
+template <typename Key>
+QList<Key> OrderedSet<Key>::values() const
+{
+    return map.keys();
+}
+
+// Sets are equal if they have the same keys in the same order
+template <typename Key>
+bool OrderedSet<Key>::operator==(const OrderedSet<Key> &other) const
+{
+    return map == other.map;
+}
+
+template <typename Key>
+bool OrderedSet<Key>::operator!=(const OrderedSet<Key> &other) const
+{
+    return map != other.map;
+}
+
+template <typename Key>
+typename OrderedSet<Key>::const_iterator OrderedSet<Key>::begin() const
+{
+    return const_iterator(map.begin());
+}
+
+template <typename Key>
+typename OrderedSet<Key>::const_iterator OrderedSet<Key>::end() const
+{
+    return const_iterator(map.end());
+}
+
+// Same format as an OrderedMap: the count followed by the keys in order
+template <typename Key>
+QDataStream &operator<<(QDataStream &out, const OrderedSet<Key> &set)
+{
+    return out << set.map;
+}
+
+/* Reads through OrderedSet::insert(), so a key repeated in the stream keeps
+ * its first position, as it would have had it been inserted twice.
+ */
+template <typename Key>
+QDataStream &operator>>(QDataStream &in, OrderedSet<Key> &set)
+{
+    set.clear();
+
+    quint32 n;
+    in >> n;
+
+    for (quint32 i = 0; i < n; ++i) {
+        Key key;
+        in >> key;
+        if (in.status() != QDataStream::Ok) {
+            set.clear();
+            break;
+        }
+        set.insert(key);
+    }
+    return in;
+}
+
+#endif // ORDEREDSET_H
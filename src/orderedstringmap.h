@@ -0,0 +1,499 @@
+#ifndef ORDEREDSTRINGMAP_H
+#define ORDEREDSTRINGMAP_H
+
+#include <QtGlobal>
+#include <QExplicitlySharedDataPointer>
+#include <QList>
+#include <QSharedData>
+#include <QString>
+#include <QVarLengthArray>
+#include <QVector>
+
+#include <string.h>
+
+#include <iterator>
+
+#include "orderedmap.h"
+#include "orderedmaphash.h"
+
+/* A key of an OrderedStringMap: its bytes, which live in the map's arena.
+ * Strings made only of Latin-1 characters take one byte per character,
+ * others are stored as UTF-8. The flag keeps the two encodings apart, as the
+ * same bytes can be valid in both.
+ */
+struct OrderedStringMapKey
+{
+    const char *data;
+    int size;
+    bool utf8;
+};
+
+inline bool operator==(const OrderedStringMapKey &key1, const OrderedStringMapKey &key2)
+{
+    return key1.size == key2.size && key1.utf8 == key2.utf8
+            && (key1.size == 0 || memcmp(key1.data, key2.data, key1.size) == 0);
+}
+
+// The bytes sit next to each other in the arena, so hash them in one go
+inline uint qHash(const OrderedStringMapKey &key)
+{
+    return oMHashBytes(key.data, key.size, uint(key.utf8));
+}
+
+/* Append-only storage for key bytes. Blocks are reference counted and never
+ * move, so keys can point into them, and copies of a map share them. A copy
+ * starts writing into a block of its own, so that two maps never write into
+ * the same block.
+ */
+class OrderedStringMapArena
+{
+public:
+    OrderedStringMapArena() : tail(NULL), tailFree(0) {}
+
+    OrderedStringMapArena(const OrderedStringMapArena &other) :
+        blocks(other.blocks), tail(NULL), tailFree(0) {}
+
+    OrderedStringMapArena &operator=(const OrderedStringMapArena &other)
+    {
+        blocks = other.blocks;
+        tail = NULL;
+        tailFree = 0;
+        return *this;
+    }
+
+    void swap(OrderedStringMapArena &other)
+    {
+        qSwap(blocks, other.blocks);
+        qSwap(tail, other.tail);
+        qSwap(tailFree, other.tailFree);
+    }
+
+    void clear()
+    {
+        blocks.clear();
+        tail = NULL;
+        tailFree = 0;
+    }
+
+    // Returns a copy of size bytes at data, valid for as long as the arena
+    const char *store(const char *data, int size)
+    {
+        if (size == 0) {
+            return tail;
+        }
+        if (size > tailFree) {
+            // Blocks double up to a limit; longer keys get a block of their own
+            int capacity = blocks.isEmpty() ? int(MinBlockSize)
+                                            : qMin(int(MaxBlockSize), 2 * blocks.last()->capacity);
+            capacity = qMax(capacity, size);
+            blocks.append(QExplicitlySharedDataPointer<Block>(new Block(capacity)));
+            tail = blocks.last()->bytes;
+            tailFree = capacity;
+        }
+        char *copy = tail;
+        memcpy(copy, data, size);
+        tail += size;
+        tailFree -= size;
+        return copy;
+    }
+
+private:
+    enum { MinBlockSize = 1024, MaxBlockSize = 64 * 1024 };
+
+    struct Block : public QSharedData
+    {
+        explicit Block(int capacity) : bytes(new char[capacity]), capacity(capacity) {}
+
+        ~Block()
+        {
+            delete[] bytes;
+        }
+
+        char *bytes;
+        int capacity;
+
+    private:
+        Q_DISABLE_COPY(Block)
+    };
+
+    QVector<QExplicitlySharedDataPointer<Block> > blocks;
+    char *tail;
+    int tailFree;
+};
+
+/* An OrderedMap with QString keys, which keeps the characters of all keys in
+ * a few large blocks instead of a heap allocation per key. Keys take one byte
+ * per character when they are Latin-1, are hashed and compared straight from
+ * those blocks, and cost no reference counting when the map is copied or
+ * iterated.
+ *
+ * Keys are handed out as QStrings made from the stored bytes, so key() and
+ * keys() allocate; lookups with a QString only convert it, into a buffer on
+ * the stack for keys up to 256 bytes. The bytes of removed keys are reclaimed
+ * once they make up more than half of the arena, by rebuilding the map.
+ */
+template <typename Value>
+class OrderedStringMap
+{
+    typedef OrderedMap<OrderedStringMapKey, Value> Map;
+
+    // Holds a key converted for a lookup, on the stack when it is short
+    typedef QVarLengthArray<char, 256> KeyBuffer;
+
+public:
+
+    class const_iterator;
+
+    typedef typename OrderedStringMap<Value>::const_iterator ConstIterator;
+
+    OrderedStringMap();
+
+    const Value &at(int i) const;
+
+    void clear();
+
+    bool contains(const QString &key) const;
+
+    int count() const;
+
+    bool empty() const;
+
+    void insert(const QString &key, const Value &value);
+
+    bool isEmpty() const;
+
+    QString keyAt(int i) const;
+
+    QList<QString> keys() const;
+
+    int remove(const QString &key);
+
+    int size() const;
+
+    Value take(const QString &key);
+
+    Value value(const QString &key) const;
+
+    Value value(const QString &key, const Value &defaultValue) const;
+
+    QList<Value> values() const;
+
+    bool operator==(const OrderedStringMap<Value> &other) const;
+
+    bool operator!=(const OrderedStringMap<Value> &other) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    const_iterator find(const QString &key) const;
+
+    class const_iterator
+    {
+        typename Map::const_iterator it;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef const Value *pointer;
+        typedef const Value &reference;
+
+        const_iterator() {}
+
+        explicit const_iterator(const typename Map::const_iterator &it) : it(it) {}
+
+        QString key() const
+        {
+            return OrderedStringMap<Value>::decode(it.key());
+        }
+
+        const Value &value() const
+        {
+            return it.value();
+        }
+
+        const Value &operator*() const
+        {
+            return it.value();
+        }
+
+        const Value *operator->() const
+        {
+            return &it.value();
+        }
+
+        bool operator==(const const_iterator &other) const
+        {
+            return it == other.it;
+        }
+
+        bool operator!=(const const_iterator &other) const
+        {
+            return it != other.it;
+        }
+
+        const_iterator &operator++()
+        {
+            ++it;
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator old = *this;
+            ++it;
+            return old;
+        }
+
+        const_iterator &operator--()
+        {
+            --it;
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            const_iterator old = *this;
+            --it;
+            return old;
+        }
+    };
+
+private:
+    enum { MinReclaimBytes = 4096 };
+
+    static QString decode(const OrderedStringMapKey &key);
+
+    static OrderedStringMapKey encode(const QString &key, KeyBuffer &buffer);
+
+    void reclaim();
+
+    Map map;
+    OrderedStringMapArena arena;
+    // Bytes in the arena still used by keys, and those of removed keys
+    int liveBytes;
+    int deadBytes;
+};
+
+template <typename Value>
+OrderedStringMap<Value>::OrderedStringMap() : liveBytes(0), deadBytes(0) {}
+
+template <typename Value>
+const Value &OrderedStringMap<Value>::at(int i) const
+{
+    return map.at(i);
+}
+
+template <typename Value>
+void OrderedStringMap<Value>::clear()
+{
+    map.clear();
+    arena.clear();
+    liveBytes = 0;
+    deadBytes = 0;
+}
+
+template <typename Value>
+bool OrderedStringMap<Value>::contains(const QString &key) const
+{
+    KeyBuffer buffer;
+    return map.contains(encode(key, buffer));
+}
+
+template <typename Value>
+int OrderedStringMap<Value>::count() const
+{
+    return map.count();
+}
+
+template <typename Value>
+bool OrderedStringMap<Value>::empty() const
+{
+    return map.empty();
+}
+
+// Like OrderedMap::insert(), an existing key is moved to the end
+template <typename Value>
+void OrderedStringMap<Value>::insert(const QString &key, const Value &value)
+{
+    KeyBuffer buffer;
+    OrderedStringMapKey lookup = encode(key, buffer);
+    typename Map::const_iterator it = map.find(lookup);
+    if (it != map.end()) {
+        // The stored bytes stay, only the node moves
+        map.insert(it.key(), value);
+        return;
+    }
+
+    OrderedStringMapKey stored = lookup;
+    stored.data = arena.store(lookup.data, lookup.size);
+    liveBytes += lookup.size;
+    map.insert(stored, value);
+}
+
+template <typename Value>
+bool OrderedStringMap<Value>::isEmpty() const
+{
+    return map.isEmpty();
+}
+
+template <typename Value>
+QString OrderedStringMap<Value>::keyAt(int i) const
+{
+    return decode(map.keyAt(i));
+}
+
+template <typename Value>
+QList<QString> OrderedStringMap<Value>::keys() const
+{
+    QList<QString> keys;
+    keys.reserve(map.size());
+    for (typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        keys.append(decode(it.key()));
+    }
+    return keys;
+}
+
+template <typename Value>
+int OrderedStringMap<Value>::remove(const QString &key)
+{
+    KeyBuffer buffer;
+    OrderedStringMapKey lookup = encode(key, buffer);
+    if (!map.remove(lookup)) {
+        return 0;
+    }
+    liveBytes -= lookup.size;
+    deadBytes += lookup.size;
+    reclaim();
+    return 1;
+}
+
+template <typename Value>
+int OrderedStringMap<Value>::size() const
+{
+    return map.size();
+}
+
+template <typename Value>
+Value OrderedStringMap<Value>::take(const QString &key)
+{
+    KeyBuffer buffer;
+    OrderedStringMapKey lookup = encode(key, buffer);
+    if (!map.contains(lookup)) {
+        return Value();
+    }
+    Value value = map.take(lookup);
+    liveBytes -= lookup.size;
+    deadBytes += lookup.size;
+    reclaim();
+    return value;
+}
+
+template <typename Value>
+Value OrderedStringMap<Value>::value(const QString &key) const
+{
+    KeyBuffer buffer;
+    return map.value(encode(key, buffer));
+}
+
+template <typename Value>
+Value OrderedStringMap<Value>::value(const QString &key, const Value &defaultValue) const
+{
+    KeyBuffer buffer;
+    return map.value(encode(key, buffer), defaultValue);
+}
+
+template <typename Value>
+QList<Value> OrderedStringMap<Value>::values() const
+{
+    return map.values();
+}
+
+template <typename Value>
+bool OrderedStringMap<Value>::operator==(const OrderedStringMap<Value> &other) const
+{
+    return map == other.map;
+}
+
+template <typename Value>
+bool OrderedStringMap<Value>::operator!=(const OrderedStringMap<Value> &other) const
+{
+    return map != other.map;
+}
+
+template <typename Value>
+typename OrderedStringMap<Value>::const_iterator OrderedStringMap<Value>::begin() const
+{
+    return const_iterator(map.begin());
+}
+
+template <typename Value>
+typename OrderedStringMap<Value>::const_iterator OrderedStringMap<Value>::end() const
+{
+    return const_iterator(map.end());
+}
+
+template <typename Value>
+typename OrderedStringMap<Value>::const_iterator OrderedStringMap<Value>::find(const QString &key) const
+{
+    KeyBuffer buffer;
+    return const_iterator(map.find(encode(key, buffer)));
+}
+
+template <typename Value>
+QString OrderedStringMap<Value>::decode(const OrderedStringMapKey &key)
+{
+    return key.utf8 ? QString::fromUtf8(key.data, key.size)
+                    : QString::fromLatin1(key.data, key.size);
+}
+
+/* Returns key as it is stored, its bytes in buffer. Latin-1 is tried first,
+ * as most keys fit it.
+ */
+template <typename Value>
+OrderedStringMapKey OrderedStringMap<Value>::encode(const QString &key, KeyBuffer &buffer)
+{
+    const int length = key.size();
+    const QChar *chars = key.constData();
+    buffer.resize(length);
+    char *bytes = buffer.data();
+    for (int i = 0; i < length; ++i) {
+        ushort c = chars[i].unicode();
+        if (c > 0xff) {
+            QByteArray utf8 = key.toUtf8();
+            buffer.resize(utf8.size());
+            memcpy(buffer.data(), utf8.constData(), utf8.size());
+            OrderedStringMapKey result = { buffer.constData(), int(buffer.size()), true };
+            return result;
+        }
+        bytes[i] = char(c);
+    }
+    OrderedStringMapKey result = { buffer.constData(), length, false };
+    return result;
+}
+
+/* Rebuilds the map into a fresh arena once the bytes of removed keys
+ * outweigh those in use. Copies of the map keep the old blocks alive.
+ */
+template <typename Value>
+void OrderedStringMap<Value>::reclaim()
+{
+    if (deadBytes < MinReclaimBytes || deadBytes <= liveBytes) {
+        return;
+    }
+
+    Map compacted;
+    OrderedStringMapArena fresh;
+    compacted.reserve(map.size());
+    for (typename Map::const_iterator it = map.begin(); it != map.end(); ++it) {
+        OrderedStringMapKey stored = it.key();
+        stored.data = fresh.store(stored.data, stored.size);
+        compacted.insert(stored, it.value());
+    }
+    map = compacted;
+    arena.swap(fresh);
+    deadBytes = 0;
+}
+
+#endif // ORDEREDSTRINGMAP_H
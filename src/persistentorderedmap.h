@@ -0,0 +1,745 @@
+#ifndef PERSISTENTORDEREDMAP_H
+#define PERSISTENTORDEREDMAP_H
+
+#include <QtGlobal>
+#include <QtAlgorithms>
+#include <QExplicitlySharedDataPointer>
+#include <QHash>
+#include <QList>
+#include <QSharedData>
+#include <QVector>
+
+#include <limits.h>
+
+#include <iterator>
+
+#include "orderedmap.h"
+
+/* An immutable ordered map. insert() and remove() leave the map alone and
+ * return a new version in O(log n), which shares all but the changed paths
+ * with the old one. Keeping many versions around, as an undo stack does,
+ * therefore costs memory in proportion to the changes rather than to the
+ * size of the map. Copying a version is O(1).
+ *
+ * Every entry is numbered in insertion order. The entries are stored by
+ * number in a sparse 32-way trie, which gives the iteration order, and keys
+ * are mapped to their number by a hash array mapped trie (HAMT). Nodes of
+ * both are reference counted and never modified once shared.
+ *
+ * Ordering matches OrderedMap: inserting a new key appends it, and inserting
+ * an existing key overwrites its value and moves it to the end.
+ */
+template <typename Key, typename Value>
+class PersistentOrderedMap
+{
+    enum { Bits = 5, Width = 1 << Bits, Mask = Width - 1 };
+
+    struct OrderNode : public QSharedData
+    {
+        OrderNode() : count(0) {}
+
+        virtual ~OrderNode() {}
+
+        // Live entries below this node
+        int count;
+    };
+
+    typedef QExplicitlySharedDataPointer<OrderNode> OrderPtr;
+
+    struct OrderBranch : public OrderNode
+    {
+        OrderPtr children[Width];
+    };
+
+    struct OrderLeaf : public OrderNode
+    {
+        OrderLeaf() : live(0) {}
+
+        quint32 live;
+        Key keys[Width];
+        Value values[Width];
+    };
+
+    struct IndexItem
+    {
+        uint hash;
+        int seq;
+        Key key;
+    };
+
+    struct IndexNode;
+
+    typedef QExplicitlySharedDataPointer<IndexNode> IndexPtr;
+
+    /* A position is a 5 bit slice of the hash, and holds either an item or a
+     * node for the next slice. Once all 32 bits are used up, a node holds the
+     * colliding items in a plain list.
+     */
+    struct IndexNode : public QSharedData
+    {
+        IndexNode() : itemMap(0), childMap(0) {}
+
+        quint32 itemMap;
+        quint32 childMap;
+        QVector<IndexItem> items;
+        QVector<IndexPtr> children;
+    };
+
+public:
+
+    class const_iterator;
+
+    typedef typename PersistentOrderedMap<Key, Value>::const_iterator ConstIterator;
+
+    PersistentOrderedMap();
+
+    explicit PersistentOrderedMap(const OrderedMap<Key, Value> &map);
+
+    const Value &at(int i) const;
+
+    bool contains(const Key &key) const;
+
+    int count() const;
+
+    bool empty() const;
+
+    Q_REQUIRED_RESULT PersistentOrderedMap<Key, Value> insert(const Key &key, const Value &value) const;
+
+    bool isEmpty() const;
+
+    const Key &keyAt(int i) const;
+
+    QList<Key> keys() const;
+
+    Q_REQUIRED_RESULT PersistentOrderedMap<Key, Value> remove(const Key &key) const;
+
+    int size() const;
+
+    OrderedMap<Key, Value> toOrderedMap() const;
+
+    Value value(const Key &key) const;
+
+    Value value(const Key &key, const Value &defaultValue) const;
+
+    QList<Value> values() const;
+
+    bool operator==(const PersistentOrderedMap<Key, Value> &other) const;
+
+    bool operator!=(const PersistentOrderedMap<Key, Value> &other) const;
+
+    const_iterator begin() const;
+
+    const_iterator end() const;
+
+    const_iterator find(const Key &key) const;
+
+    // Stays valid for as long as the version it came from
+    class const_iterator
+    {
+        const PersistentOrderedMap *map;
+        const OrderLeaf *leaf;
+        int seq;
+
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef const Value *pointer;
+        typedef const Value &reference;
+
+        const_iterator() : map(NULL), leaf(NULL), seq(0) {}
+
+        const_iterator(const PersistentOrderedMap *map, const OrderLeaf *leaf, int seq) :
+            map(map), leaf(leaf), seq(seq) {}
+
+        const Key & key() const
+        {
+            return leaf->keys[seq & Mask];
+        }
+
+        const Value & value() const
+        {
+            return leaf->values[seq & Mask];
+        }
+
+        const Value & operator*() const
+        {
+            return value();
+        }
+
+        const_iterator& operator++()
+        {
+            // Entries left in the same leaf are found from its live bits alone
+            quint32 rest = leaf->live & ~((2u << (seq & Mask)) - 1);
+            if (rest) {
+                seq = (seq & ~int(Mask)) + lowestBit(rest);
+            } else {
+                // The last leaf can end at INT_MAX, so the next one is 64-bit
+                qint64 from = qint64(seq | Mask) + 1;
+                seq = from < map->nextSeq ? firstFrom(map->order.data(), map->orderShift, from, &leaf) : -1;
+                if (seq < 0) {
+                    seq = map->nextSeq;
+                }
+            }
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator it = *this;
+            ++*this;
+            return it;
+        }
+
+        bool operator ==(const const_iterator &other) const
+        {
+            return (seq == other.seq);
+        }
+
+        bool operator !=(const const_iterator &other) const
+        {
+            return (seq != other.seq);
+        }
+    };
+
+private:
+    void appendEntry(const Key &key, const Value &value, uint hash, bool inPlace);
+
+    static int bitIndex(quint32 map, quint32 bit);
+
+    int findSeq(const Key &key, uint hash) const;
+
+    static int firstFrom(const OrderNode *node, int shift, qint64 from, const OrderLeaf **leaf);
+
+    static IndexPtr indexInsert(const IndexNode *node, int shift, const IndexItem &item, bool inPlace);
+
+    static IndexPtr indexRemove(const IndexNode *node, int shift, uint hash, const Key &key);
+
+    const OrderLeaf *leafOf(int seq) const;
+
+    static int lowestBit(quint32 bits);
+
+    static OrderPtr orderErase(const OrderNode *node, int shift, int seq);
+
+    static OrderPtr orderSet(const OrderNode *node, int shift, int seq,
+                             const Key &key, const Value &value, bool inPlace);
+
+    void renumber();
+
+    int slotAt(int rank, const OrderLeaf **leaf) const;
+
+    OrderPtr order;
+    IndexPtr index;
+    // Bit offset of the root's slice of an entry number
+    int orderShift;
+    int nextSeq;
+    int entries;
+};
+
+template <typename Key, typename Value>
+PersistentOrderedMap<Key, Value>::PersistentOrderedMap() :
+    orderShift(0), nextSeq(0), entries(0)
+{
+}
+
+/* The new nodes are not shared with anything yet, so they are filled in
+ * place rather than copied for every entry.
+ */
+template <typename Key, typename Value>
+PersistentOrderedMap<Key, Value>::PersistentOrderedMap(const OrderedMap<Key, Value> &map) :
+    orderShift(0), nextSeq(0), entries(0)
+{
+    typename OrderedMap<Key, Value>::const_iterator it = map.begin();
+    for (; it != map.end(); ++it) {
+        appendEntry(it.key(), it.value(), qHash(it.key()), true);
+    }
+    entries = map.size();
+}
+
+template <typename Key, typename Value>
+const Value &PersistentOrderedMap<Key, Value>::at(int i) const
+{
+    Q_ASSERT(i >= 0 && i < entries);
+    const OrderLeaf *leaf;
+    int slot = slotAt(i, &leaf);
+    return leaf->values[slot];
+}
+
+template <typename Key, typename Value>
+bool PersistentOrderedMap<Key, Value>::contains(const Key &key) const
+{
+    return findSeq(key, qHash(key)) >= 0;
+}
+
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::count() const
+{
+    return entries;
+}
+
+template <typename Key, typename Value>
+bool PersistentOrderedMap<Key, Value>::empty() const
+{
+    return entries == 0;
+}
+
+template <typename Key, typename Value>
+PersistentOrderedMap<Key, Value> PersistentOrderedMap<Key, Value>::insert(const Key &key, const Value &value) const
+{
+    uint hash = qHash(key);
+    int seq = findSeq(key, hash);
+    PersistentOrderedMap<Key, Value> next(*this);
+
+    if (seq >= 0 && seq == nextSeq - 1) {
+        // Already the last entry, only its value changes
+        next.order = orderSet(order.data(), orderShift, seq, key, value, false);
+        return next;
+    }
+
+    if (seq >= 0) {
+        next.order = orderErase(order.data(), orderShift, seq);
+    } else {
+        ++next.entries;
+    }
+    if (next.nextSeq == INT_MAX) {
+        next.renumber();
+    }
+    next.appendEntry(key, value, hash, false);
+    return next;
+}
+
+template <typename Key, typename Value>
+bool PersistentOrderedMap<Key, Value>::isEmpty() const
+{
+    return entries == 0;
+}
+
+template <typename Key, typename Value>
+const Key &PersistentOrderedMap<Key, Value>::keyAt(int i) const
+{
+    Q_ASSERT(i >= 0 && i < entries);
+    const OrderLeaf *leaf;
+    int slot = slotAt(i, &leaf);
+    return leaf->keys[slot];
+}
+
+template <typename Key, typename Value>
+QList<Key> PersistentOrderedMap<Key, Value>::keys() const
+{
+    QList<Key> keys;
+    keys.reserve(entries);
+    for (const_iterator it = begin(); it != end(); ++it) {
+        keys.append(it.key());
+    }
+    return keys;
+}
+
+template <typename Key, typename Value>
+PersistentOrderedMap<Key, Value> PersistentOrderedMap<Key, Value>::remove(const Key &key) const
+{
+    uint hash = qHash(key);
+    int seq = findSeq(key, hash);
+    if (seq < 0) {
+        return *this;
+    }
+    if (entries == 1) {
+        return PersistentOrderedMap<Key, Value>();
+    }
+
+    PersistentOrderedMap<Key, Value> next(*this);
+    next.order = orderErase(order.data(), orderShift, seq);
+    next.index = indexRemove(index.data(), 0, hash, key);
+    --next.entries;
+    return next;
+}
+
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::size() const
+{
+    return entries;
+}
+
+template <typename Key, typename Value>
+OrderedMap<Key, Value> PersistentOrderedMap<Key, Value>::toOrderedMap() const
+{
+    OrderedMap<Key, Value> map;
+    map.reserve(entries);
+    for (const_iterator it = begin(); it != end(); ++it) {
+        map.insert(it.key(), it.value());
+    }
+    return map;
+}
+
+template <typename Key, typename Value>
+Value PersistentOrderedMap<Key, Value>::value(const Key &key) const
+{
+    int seq = findSeq(key, qHash(key));
+    return seq < 0 ? Value() : leafOf(seq)->values[seq & Mask];
+}
+
+template <typename Key, typename Value>
+Value PersistentOrderedMap<Key, Value>::value(const Key &key, const Value &defaultValue) const
+{
+    int seq = findSeq(key, qHash(key));
+    return seq < 0 ? defaultValue : leafOf(seq)->values[seq & Mask];
+}
+
+template <typename Key, typename Value>
+QList<Value> PersistentOrderedMap<Key, Value>::values() const
+{
+    QList<Value> values;
+    values.reserve(entries);
+    for (const_iterator it = begin(); it != end(); ++it) {
+        values.append(it.value());
+    }
+    return values;
+}
+
+template <typename Key, typename Value>
+bool PersistentOrderedMap<Key, Value>::operator==(const PersistentOrderedMap<Key, Value> &other) const
+{
+    if (entries != other.entries) {
+        return false;
+    }
+    if (order.data() == other.order.data()) {
+        return true;
+    }
+    const_iterator it1 = begin();
+    const_iterator it2 = other.begin();
+    for (; it1 != end(); ++it1, ++it2) {
+        if (!oMHashEqualToKey(it1.key(), it2.key()) || !(it1.value() == it2.value())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Key, typename Value>
+bool PersistentOrderedMap<Key, Value>::operator!=(const PersistentOrderedMap<Key, Value> &other) const
+{
+    return !(*this == other);
+}
+
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::const_iterator PersistentOrderedMap<Key, Value>::begin() const
+{
+    const OrderLeaf *leaf = NULL;
+    int seq = firstFrom(order.data(), orderShift, 0, &leaf);
+    return const_iterator(this, leaf, seq < 0 ? nextSeq : seq);
+}
+
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::const_iterator PersistentOrderedMap<Key, Value>::end() const
+{
+    return const_iterator(this, NULL, nextSeq);
+}
+
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::const_iterator PersistentOrderedMap<Key, Value>::find(const Key &key) const
+{
+    int seq = findSeq(key, qHash(key));
+    if (seq < 0) {
+        return end();
+    }
+    return const_iterator(this, leafOf(seq), seq);
+}
+
+// Numbers a key that is not in the map yet as the newest entry
+template <typename Key, typename Value>
+void PersistentOrderedMap<Key, Value>::appendEntry(const Key &key, const Value &value, uint hash, bool inPlace)
+{
+    int seq = nextSeq++;
+    while ((seq >> orderShift) >= Width) {
+        if (order) {
+            OrderBranch *root = new OrderBranch;
+            root->count = order->count;
+            root->children[0] = order;
+            order = OrderPtr(root);
+        }
+        orderShift += Bits;
+    }
+    order = orderSet(order.data(), orderShift, seq, key, value, inPlace);
+
+    IndexItem item = { hash, seq, key };
+    index = indexInsert(index.data(), 0, item, inPlace);
+}
+
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::bitIndex(quint32 map, quint32 bit)
+{
+    return int(qPopulationCount(map & (bit - 1)));
+}
+
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::findSeq(const Key &key, uint hash) const
+{
+    const IndexNode *node = index.data();
+    for (int shift = 0; node; shift += Bits) {
+        if (shift >= 32) {
+            for (int i = 0; i < node->items.size(); ++i) {
+                const IndexItem &item = node->items.at(i);
+                if (item.hash == hash && oMHashEqualToKey(item.key, key)) {
+                    return item.seq;
+                }
+            }
+            return -1;
+        }
+
+        quint32 bit = 1u << ((hash >> shift) & Mask);
+        if (node->itemMap & bit) {
+            const IndexItem &item = node->items.at(bitIndex(node->itemMap, bit));
+            return item.hash == hash && oMHashEqualToKey(item.key, key) ? item.seq : -1;
+        }
+        if (!(node->childMap & bit)) {
+            return -1;
+        }
+        node = node->children.at(bitIndex(node->childMap, bit)).data();
+    }
+    return -1;
+}
+
+/* Returns the number of the first live entry numbered from on, and its leaf,
+ * or -1 if there is none. Empty subtrees are pruned, so this descends into
+ * at most one subtree that has nothing to offer per level.
+ */
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::firstFrom(const OrderNode *node, int shift, qint64 from, const OrderLeaf **leaf)
+{
+    if (!node) {
+        return -1;
+    }
+    if (shift == 0) {
+        const OrderLeaf *candidate = static_cast<const OrderLeaf *>(node);
+        quint32 rest = candidate->live & ~((1u << (from & Mask)) - 1);
+        if (!rest) {
+            return -1;
+        }
+        *leaf = candidate;
+        return int(from & ~qint64(Mask)) + lowestBit(rest);
+    }
+
+    const OrderBranch *branch = static_cast<const OrderBranch *>(node);
+    for (int i = (from >> shift) & Mask; i < Width; ++i) {
+        int seq = firstFrom(branch->children[i].data(), shift - Bits, from, leaf);
+        if (seq >= 0) {
+            return seq;
+        }
+        // Later children are searched from their start
+        from = ((from >> shift) + 1) << shift;
+    }
+    return -1;
+}
+
+/* Returns a node with item added, or replacing the item with the same key.
+ * With inPlace, node is known not to be shared and is modified directly.
+ */
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::IndexPtr
+PersistentOrderedMap<Key, Value>::indexInsert(const IndexNode *node, int shift, const IndexItem &item, bool inPlace)
+{
+    IndexNode *copy = !node ? new IndexNode
+                            : inPlace ? const_cast<IndexNode *>(node) : new IndexNode(*node);
+
+    if (shift >= 32) {
+        for (int i = 0; i < copy->items.size(); ++i) {
+            if (copy->items.at(i).hash == item.hash && oMHashEqualToKey(copy->items.at(i).key, item.key)) {
+                copy->items[i] = item;
+                return IndexPtr(copy);
+            }
+        }
+        copy->items.append(item);
+        return IndexPtr(copy);
+    }
+
+    quint32 bit = 1u << ((item.hash >> shift) & Mask);
+    if (copy->itemMap & bit) {
+        int i = bitIndex(copy->itemMap, bit);
+        const IndexItem existing = copy->items.at(i);
+        if (existing.hash == item.hash && oMHashEqualToKey(existing.key, item.key)) {
+            copy->items[i] = item;
+            return IndexPtr(copy);
+        }
+
+        // Two keys share this slice of their hashes, move both a level down
+        IndexPtr child = indexInsert(NULL, shift + Bits, existing, true);
+        child = indexInsert(child.data(), shift + Bits, item, true);
+        copy->items.remove(i);
+        copy->itemMap &= ~bit;
+        copy->childMap |= bit;
+        copy->children.insert(bitIndex(copy->childMap, bit), child);
+    } else if (copy->childMap & bit) {
+        int i = bitIndex(copy->childMap, bit);
+        copy->children[i] = indexInsert(copy->children.at(i).data(), shift + Bits, item, inPlace);
+    } else {
+        copy->itemMap |= bit;
+        copy->items.insert(bitIndex(copy->itemMap, bit), item);
+    }
+    return IndexPtr(copy);
+}
+
+// Returns a node without key, which must be present, or null if none is left
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::IndexPtr
+PersistentOrderedMap<Key, Value>::indexRemove(const IndexNode *node, int shift, uint hash, const Key &key)
+{
+    if (shift >= 32) {
+        if (node->items.size() == 1) {
+            return IndexPtr();
+        }
+        IndexNode *copy = new IndexNode(*node);
+        for (int i = 0; i < copy->items.size(); ++i) {
+            if (copy->items.at(i).hash == hash && oMHashEqualToKey(copy->items.at(i).key, key)) {
+                copy->items.remove(i);
+                break;
+            }
+        }
+        return IndexPtr(copy);
+    }
+
+    quint32 bit = 1u << ((hash >> shift) & Mask);
+    if (node->itemMap & bit) {
+        if (node->items.size() == 1 && node->children.isEmpty()) {
+            return IndexPtr();
+        }
+        IndexNode *copy = new IndexNode(*node);
+        copy->items.remove(bitIndex(copy->itemMap, bit));
+        copy->itemMap &= ~bit;
+        return IndexPtr(copy);
+    }
+
+    int i = bitIndex(node->childMap, bit);
+    IndexPtr child = indexRemove(node->children.at(i).data(), shift + Bits, hash, key);
+    if (!child && node->items.isEmpty() && node->children.size() == 1) {
+        return IndexPtr();
+    }
+
+    IndexNode *copy = new IndexNode(*node);
+    if (!child) {
+        copy->children.remove(i);
+        copy->childMap &= ~bit;
+    } else if (child->children.isEmpty() && child->items.size() == 1) {
+        // A lone item moves back up, so lookups stay short
+        copy->children.remove(i);
+        copy->childMap &= ~bit;
+        copy->itemMap |= bit;
+        copy->items.insert(bitIndex(copy->itemMap, bit), child->items.at(0));
+    } else {
+        copy->children[i] = child;
+    }
+    return IndexPtr(copy);
+}
+
+template <typename Key, typename Value>
+const typename PersistentOrderedMap<Key, Value>::OrderLeaf *PersistentOrderedMap<Key, Value>::leafOf(int seq) const
+{
+    const OrderNode *node = order.data();
+    for (int shift = orderShift; shift > 0; shift -= Bits) {
+        node = static_cast<const OrderBranch *>(node)->children[(seq >> shift) & Mask].data();
+    }
+    return static_cast<const OrderLeaf *>(node);
+}
+
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::lowestBit(quint32 bits)
+{
+    return int(qPopulationCount((bits & (0u - bits)) - 1));
+}
+
+// Returns a node without entry seq, which must be live, or null if it was the last
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::OrderPtr
+PersistentOrderedMap<Key, Value>::orderErase(const OrderNode *node, int shift, int seq)
+{
+    if (node->count == 1) {
+        return OrderPtr();
+    }
+
+    if (shift == 0) {
+        OrderLeaf *leaf = new OrderLeaf(*static_cast<const OrderLeaf *>(node));
+        int slot = seq & Mask;
+        leaf->live &= ~(1u << slot);
+        leaf->keys[slot] = Key();
+        leaf->values[slot] = Value();
+        --leaf->count;
+        return OrderPtr(leaf);
+    }
+
+    OrderBranch *branch = new OrderBranch(*static_cast<const OrderBranch *>(node));
+    OrderPtr &child = branch->children[(seq >> shift) & Mask];
+    child = orderErase(child.data(), shift - Bits, seq);
+    --branch->count;
+    return OrderPtr(branch);
+}
+
+/* Returns a node with entry seq set. With inPlace, node is known not to be
+ * shared and is modified directly.
+ */
+template <typename Key, typename Value>
+typename PersistentOrderedMap<Key, Value>::OrderPtr
+PersistentOrderedMap<Key, Value>::orderSet(const OrderNode *node, int shift, int seq,
+                                           const Key &key, const Value &value, bool inPlace)
+{
+    if (shift == 0) {
+        const OrderLeaf *old = static_cast<const OrderLeaf *>(node);
+        OrderLeaf *leaf = !old ? new OrderLeaf
+                               : inPlace ? const_cast<OrderLeaf *>(old) : new OrderLeaf(*old);
+        int slot = seq & Mask;
+        if (!(leaf->live & (1u << slot))) {
+            leaf->live |= 1u << slot;
+            ++leaf->count;
+        }
+        leaf->keys[slot] = key;
+        leaf->values[slot] = value;
+        return OrderPtr(leaf);
+    }
+
+    const OrderBranch *old = static_cast<const OrderBranch *>(node);
+    OrderBranch *branch = !old ? new OrderBranch
+                               : inPlace ? const_cast<OrderBranch *>(old) : new OrderBranch(*old);
+    OrderPtr &child = branch->children[(seq >> shift) & Mask];
+    int before = child ? child->count : 0;
+    child = orderSet(child.data(), shift - Bits, seq, key, value, inPlace);
+    branch->count += child->count - before;
+    return OrderPtr(branch);
+}
+
+// Entry numbers ran out, so number the entries afresh from 0
+template <typename Key, typename Value>
+void PersistentOrderedMap<Key, Value>::renumber()
+{
+    PersistentOrderedMap<Key, Value> fresh;
+    for (const_iterator it = begin(); it != end(); ++it) {
+        fresh.appendEntry(it.key(), it.value(), qHash(it.key()), true);
+    }
+    fresh.entries = entries;
+    *this = fresh;
+}
+
+// Finds the entry at rank in insertion order, by the live counts of the nodes
+template <typename Key, typename Value>
+int PersistentOrderedMap<Key, Value>::slotAt(int rank, const OrderLeaf **leaf) const
+{
+    const OrderNode *node = order.data();
+    for (int shift = orderShift; shift > 0; shift -= Bits) {
+        const OrderBranch *branch = static_cast<const OrderBranch *>(node);
+        for (int i = 0; i < Width; ++i) {
+            const OrderNode *child = branch->children[i].data();
+            if (child) {
+                if (rank < child->count) {
+                    node = child;
+                    break;
+                }
+                rank -= child->count;
+            }
+        }
+    }
+
+    *leaf = static_cast<const OrderLeaf *>(node);
+    quint32 live = (*leaf)->live;
+    for (; rank > 0; --rank) {
+        live &= live - 1;
+    }
+    return lowestBit(live);
+}
+
+#endif // PERSISTENTORDEREDMAP_H
@@ -3,5 +3,15 @@ INCLUDEPATH += $$PWD
 SOURCES +=
 
 HEADERS += \
-    $$PWD/orderedmap.h
+    $$PWD/concurrentorderedmap.h \
+    $$PWD/orderedmap.h \
+    $$PWD/orderedmapconcurrent.h \
+    $$PWD/orderedmapdiff.h \
+    $$PWD/orderedmaphash.h \
+    $$PWD/orderedmapjournal.h \
+    $$PWD/orderedmapview.h \
+    $$PWD/orderedset.h \
+    $$PWD/orderedstringmap.h \
+    $$PWD/persistentorderedmap.h \
+    $$PWD/staticorderedmap.h
 
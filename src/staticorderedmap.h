@@ -0,0 +1,682 @@
+#ifndef STATICORDEREDMAP_H
+#define STATICORDEREDMAP_H
+
+#include <QtGlobal>
+#include <QHash>
+
+#include "orderedmap.h"
+
+// What StaticOrderedMap::insert() does with a new key once the map is full
+enum StaticOrderedMapOverflow
+{
+    RejectWhenFull,         // insert() leaves the map alone and returns false
+    EvictOldestWhenFull     // the oldest entry is removed to make room
+};
+
+// Number of bits of the smallest index that is at most half full with N keys
+template <int N, int Bits = 3, int Size = 8, bool Fits = (Size / 2 >= N)>
+struct StaticOrderedMapIndexBits
+{
+    enum { Value = StaticOrderedMapIndexBits<N, Bits + 1, Size * 2>::Value };
+};
+
+template <int N, int Bits, int Size>
+struct StaticOrderedMapIndexBits<N, Bits, Size, true>
+{
+    enum { Value = Bits };
+};
+
+/* An ordered map with a fixed capacity of N entries, for code that must not
+ * allocate, such as real-time threads. Entries and their hash index are
+ * stored inside the map object itself, and construction is constexpr when
+ * Key and Value are literal types, so a map can be statically initialized.
+ *
+ * Inserting behaves like OrderedMap::insert(): a new key is appended, and an
+ * existing key is overwritten and moved to the end. Once N entries are
+ * present, a new key is rejected or evicts the oldest entry, depending on
+ * Overflow. Keys must have a qHash() overload.
+ *
+ * Entries live in a ring, so evicting the oldest entry is O(1). Removing
+ * other entries leaves holes that are compacted away once an insert reaches
+ * the end of the ring; that bounds a single insert to O(N), never more.
+ * Inserting may therefore invalidate iterators, removing never does.
+ */
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow = RejectWhenFull>
+class StaticOrderedMap
+{
+    Q_STATIC_ASSERT_X(N > 0, "StaticOrderedMap needs a capacity of at least one entry");
+
+    struct Node
+    {
+        Q_DECL_CONSTEXPR Node() : key(), value(), hash(0), live(false) {}
+
+        Key key;
+        Value value;
+        uint hash;
+        bool live;
+    };
+
+    // Same layout as OrderedMap's index: node position + 1, 0 for free
+    struct IndexSlot
+    {
+        Q_DECL_CONSTEXPR IndexSlot() : hash(0), pos(0) {}
+
+        uint hash;
+        int pos;
+    };
+
+    enum {
+        IndexBits = StaticOrderedMapIndexBits<N>::Value,
+        IndexSize = 1 << IndexBits
+    };
+
+public:
+
+    class iterator;
+    class const_iterator;
+
+    typedef typename StaticOrderedMap<Key, Value, N, Overflow>::iterator Iterator;
+    typedef typename StaticOrderedMap<Key, Value, N, Overflow>::const_iterator ConstIterator;
+
+    Q_DECL_CONSTEXPR StaticOrderedMap();
+
+    static Q_DECL_CONSTEXPR int capacity()
+    {
+        return N;
+    }
+
+    void clear();
+
+    bool contains(const Key &key) const;
+
+    int count() const;
+
+    bool empty() const;
+
+    bool insert(const Key &key, const Value &value);
+
+    bool isEmpty() const;
+
+    bool isFull() const;
+
+    int remove(const Key &key);
+
+    int size() const;
+
+    Value take(const Key &key);
+
+    Value value(const Key &key) const;
+
+    Value value(const Key &key, const Value &defaultValue) const;
+
+    bool operator==(const StaticOrderedMap<Key, Value, N, Overflow> &other) const;
+
+    bool operator!=(const StaticOrderedMap<Key, Value, N, Overflow> &other) const;
+
+    iterator begin();
+
+    const_iterator begin() const;
+
+    iterator end();
+
+    const_iterator end() const;
+
+    iterator erase(iterator pos);
+
+    iterator find(const Key &key);
+
+    const_iterator find(const Key &key) const;
+
+    class iterator
+    {
+        StaticOrderedMap *map;
+        int pos;
+        friend class const_iterator;
+        friend class StaticOrderedMap;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef Value *pointer;
+        typedef Value &reference;
+
+        iterator() : map(NULL), pos(0) {}
+
+        iterator(StaticOrderedMap *map, int pos) :
+            map(map), pos(pos) {}
+
+        const Key & key() const
+        {
+            return map->nodes[pos].key;
+        }
+
+        Value & value() const
+        {
+            return map->nodes[pos].value;
+        }
+
+        Value & operator*() const
+        {
+            return value();
+        }
+
+        iterator& operator++()
+        {
+            pos = map->nextLive(pos);
+            return *this;
+        }
+
+        iterator operator++(int)
+        {
+            iterator it = *this;
+            pos = map->nextLive(pos);
+            return it;
+        }
+
+        iterator& operator--()
+        {
+            pos = map->previousLive(pos);
+            return *this;
+        }
+
+        iterator operator--(int)
+        {
+            iterator it = *this;
+            pos = map->previousLive(pos);
+            return it;
+        }
+
+        bool operator ==(const iterator &other) const
+        {
+            return (pos == other.pos);
+        }
+
+        bool operator !=(const iterator &other) const
+        {
+            return (pos != other.pos);
+        }
+    };
+
+    class const_iterator
+    {
+        const StaticOrderedMap *map;
+        int pos;
+
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef qptrdiff difference_type;
+        typedef Value value_type;
+        typedef const Value *pointer;
+        typedef const Value &reference;
+
+        const_iterator() : map(NULL), pos(0) {}
+
+        const_iterator(const iterator &i) :
+            map(i.map), pos(i.pos) {}
+
+        const_iterator(const StaticOrderedMap *map, int pos) :
+            map(map), pos(pos) {}
+
+        const Key & key() const
+        {
+            return map->nodes[pos].key;
+        }
+
+        const Value & value() const
+        {
+            return map->nodes[pos].value;
+        }
+
+        const Value & operator*() const
+        {
+            return value();
+        }
+
+        const_iterator& operator++()
+        {
+            pos = map->nextLive(pos);
+            return *this;
+        }
+
+        const_iterator operator++(int)
+        {
+            const_iterator it = *this;
+            pos = map->nextLive(pos);
+            return it;
+        }
+
+        const_iterator& operator--()
+        {
+            pos = map->previousLive(pos);
+            return *this;
+        }
+
+        const_iterator operator--(int)
+        {
+            const_iterator it = *this;
+            pos = map->previousLive(pos);
+            return it;
+        }
+
+        bool operator ==(const const_iterator &other) const
+        {
+            return (pos == other.pos);
+        }
+
+        bool operator !=(const const_iterator &other) const
+        {
+            return (pos != other.pos);
+        }
+    };
+
+private:
+    void append(const Key &key, const Value &value, uint hash);
+
+    void compact();
+
+    int findNode(const Key &key, uint hash, int *slot = NULL) const;
+
+    int homeSlot(uint hash) const;
+
+    void killNode(int pos);
+
+    void linkNode(int pos);
+
+    int nextLive(int pos) const;
+
+    int offsetOf(int pos) const;
+
+    int physical(int offset) const;
+
+    int previousLive(int pos) const;
+
+    void removeFromIndex(int slot);
+
+    int slotOf(int pos) const;
+
+    /* nodes is a ring of used entries starting at head, live ones and holes.
+     * The entries at both ends are always live, so the oldest one is at head.
+     * Iterators hold node positions, with N for end().
+     */
+    Node nodes[N];
+    IndexSlot index[IndexSize];
+    int head;
+    int used;
+    int liveNodes;
+};
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+Q_DECL_CONSTEXPR StaticOrderedMap<Key, Value, N, Overflow>::StaticOrderedMap() :
+    nodes(), index(), head(0), used(0), liveNodes(0)
+{
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::clear()
+{
+    for (int offset = 0; offset < used; ++offset) {
+        Node &node = nodes[physical(offset)];
+        node.key = Key();
+        node.value = Value();
+        node.live = false;
+    }
+    for (int slot = 0; slot < IndexSize; ++slot) {
+        index[slot].hash = 0;
+        index[slot].pos = 0;
+    }
+    head = 0;
+    used = 0;
+    liveNodes = 0;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::contains(const Key &key) const
+{
+    return findNode(key, qHash(key)) >= 0;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::count() const
+{
+    return liveNodes;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::empty() const
+{
+    return liveNodes == 0;
+}
+
+/* Returns false if key is new and the map is full with RejectWhenFull, in
+ * which case the map is unchanged. Otherwise the entry ends up last.
+ */
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::insert(const Key &key, const Value &value)
+{
+    uint hash = qHash(key);
+    int slot;
+    int pos = findNode(key, hash, &slot);
+
+    if (pos >= 0 && pos == physical(used - 1)) {
+        // Already the last entry, nothing to move
+        nodes[pos].value = value;
+        return true;
+    }
+    if (pos < 0 && liveNodes == N && Overflow == RejectWhenFull) {
+        return false;
+    }
+
+    // Copied before any node is cleared or moved, as key or value may refer to one
+    Key nodeKey(key);
+    Value nodeValue(value);
+    if (pos >= 0) {
+        removeFromIndex(slot);
+        killNode(pos);
+    } else if (liveNodes == N) {
+        removeFromIndex(slotOf(head));
+        killNode(head);
+    }
+
+    append(nodeKey, nodeValue, hash);
+    return true;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::isEmpty() const
+{
+    return liveNodes == 0;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::isFull() const
+{
+    return liveNodes == N;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::remove(const Key &key)
+{
+    int slot;
+    int pos = findNode(key, qHash(key), &slot);
+    if (pos < 0) {
+        return 0;
+    }
+    removeFromIndex(slot);
+    killNode(pos);
+    return 1;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::size() const
+{
+    return liveNodes;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+Value StaticOrderedMap<Key, Value, N, Overflow>::take(const Key &key)
+{
+    int slot;
+    int pos = findNode(key, qHash(key), &slot);
+    if (pos < 0) {
+        return Value();
+    }
+    Value value;
+    qSwap(value, nodes[pos].value);
+    removeFromIndex(slot);
+    killNode(pos);
+    return value;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+Value StaticOrderedMap<Key, Value, N, Overflow>::value(const Key &key) const
+{
+    int pos = findNode(key, qHash(key));
+    return pos < 0 ? Value() : nodes[pos].value;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+Value StaticOrderedMap<Key, Value, N, Overflow>::value(const Key &key, const Value &defaultValue) const
+{
+    int pos = findNode(key, qHash(key));
+    return pos < 0 ? defaultValue : nodes[pos].value;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::operator==(const StaticOrderedMap<Key, Value, N, Overflow> &other) const
+{
+    if (size() != other.size()) {
+        return false;
+    }
+    const_iterator it1 = begin();
+    const_iterator it2 = other.begin();
+    for (; it1 != end(); ++it1, ++it2) {
+        if (!oMHashEqualToKey(it1.key(), it2.key()) || !(it1.value() == it2.value())) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+bool StaticOrderedMap<Key, Value, N, Overflow>::operator!=(const StaticOrderedMap<Key, Value, N, Overflow> &other) const
+{
+    return !(*this == other);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::iterator StaticOrderedMap<Key, Value, N, Overflow>::begin()
+{
+    return iterator(this, used ? head : N);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::const_iterator StaticOrderedMap<Key, Value, N, Overflow>::begin() const
+{
+    return const_iterator(this, used ? head : N);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::iterator StaticOrderedMap<Key, Value, N, Overflow>::end()
+{
+    return iterator(this, N);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::const_iterator StaticOrderedMap<Key, Value, N, Overflow>::end() const
+{
+    return const_iterator(this, N);
+}
+
+// Returns the entry after pos, which stays valid
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::iterator StaticOrderedMap<Key, Value, N, Overflow>::erase(iterator pos)
+{
+    if (pos.pos == N) {
+        return end();
+    }
+    int next = nextLive(pos.pos);
+    removeFromIndex(slotOf(pos.pos));
+    killNode(pos.pos);
+    return iterator(this, next);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::iterator StaticOrderedMap<Key, Value, N, Overflow>::find(const Key &key)
+{
+    int pos = findNode(key, qHash(key));
+    return iterator(this, pos < 0 ? N : pos);
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+typename StaticOrderedMap<Key, Value, N, Overflow>::const_iterator StaticOrderedMap<Key, Value, N, Overflow>::find(const Key &key) const
+{
+    int pos = findNode(key, qHash(key));
+    return const_iterator(this, pos < 0 ? N : pos);
+}
+
+// Appends a key that is not in the map, which must not be full
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::append(const Key &key, const Value &value, uint hash)
+{
+    if (used == N) {
+        compact();
+    }
+    if (used == 0) {
+        head = 0;
+    }
+    int pos = physical(used);
+    Node &node = nodes[pos];
+    node.key = key;
+    node.value = value;
+    node.hash = hash;
+    node.live = true;
+    ++used;
+    ++liveNodes;
+    linkNode(pos);
+}
+
+/* Moves the live entries together, keeping head where it is. An entry only
+ * ever moves towards head, so no entry is overwritten before it has moved.
+ */
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::compact()
+{
+    int live = 0;
+    for (int offset = 0; offset < used; ++offset) {
+        int pos = physical(offset);
+        if (nodes[pos].live) {
+            if (offset != live) {
+                qSwap(nodes[physical(live)], nodes[pos]);
+            }
+            ++live;
+        }
+    }
+    used = live;
+
+    for (int slot = 0; slot < IndexSize; ++slot) {
+        index[slot].hash = 0;
+        index[slot].pos = 0;
+    }
+    for (int offset = 0; offset < used; ++offset) {
+        linkNode(physical(offset));
+    }
+}
+
+/* Returns the node position of key, or -1. If slot is given, it is set to the
+ * index slot holding key or, on a miss, to the free slot ending the probe.
+ */
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::findNode(const Key &key, uint hash, int *slot) const
+{
+    int probe = homeSlot(hash);
+    for (; index[probe].pos; probe = (probe + 1) & (IndexSize - 1)) {
+        if (index[probe].hash == hash && oMHashEqualToKey(nodes[index[probe].pos - 1].key, key)) {
+            break;
+        }
+    }
+    if (slot) {
+        *slot = probe;
+    }
+    return index[probe].pos - 1;
+}
+
+// Fibonacci hashing, as in OrderedMap
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::homeSlot(uint hash) const
+{
+    return int((hash * 0x9E3779B9U) >> (32 - IndexBits));
+}
+
+// Clears the node at pos, then trims holes off both ends of the ring
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::killNode(int pos)
+{
+    Node &node = nodes[pos];
+    node.live = false;
+    node.key = Key();
+    node.value = Value();
+    --liveNodes;
+
+    while (used && !nodes[head].live) {
+        head = physical(1);
+        --used;
+    }
+    while (used && !nodes[physical(used - 1)].live) {
+        --used;
+    }
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::linkNode(int pos)
+{
+    int slot = homeSlot(nodes[pos].hash);
+    while (index[slot].pos) {
+        slot = (slot + 1) & (IndexSize - 1);
+    }
+    index[slot].hash = nodes[pos].hash;
+    index[slot].pos = pos + 1;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::nextLive(int pos) const
+{
+    for (int offset = offsetOf(pos) + 1; offset < used; ++offset) {
+        int next = physical(offset);
+        if (nodes[next].live) {
+            return next;
+        }
+    }
+    return N;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::offsetOf(int pos) const
+{
+    return pos >= head ? pos - head : pos + N - head;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::physical(int offset) const
+{
+    int pos = head + offset;
+    return pos < N ? pos : pos - N;
+}
+
+// From end(), steps back to the newest entry
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::previousLive(int pos) const
+{
+    int offset = pos == N ? used : offsetOf(pos);
+    while (--offset > 0 && !nodes[physical(offset)].live) {}
+    return physical(qMax(offset, 0));
+}
+
+// Backward shift deletion, as in OrderedMap
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+void StaticOrderedMap<Key, Value, N, Overflow>::removeFromIndex(int slot)
+{
+    const int mask = IndexSize - 1;
+    int hole = slot;
+    for (int next = (hole + 1) & mask; index[next].pos; next = (next + 1) & mask) {
+        int home = homeSlot(index[next].hash);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            index[hole] = index[next];
+            hole = next;
+        }
+    }
+    index[hole].hash = 0;
+    index[hole].pos = 0;
+}
+
+template <typename Key, typename Value, int N, StaticOrderedMapOverflow Overflow>
+int StaticOrderedMap<Key, Value, N, Overflow>::slotOf(int pos) const
+{
+    int slot = homeSlot(nodes[pos].hash);
+    while (index[slot].pos != pos + 1) {
+        slot = (slot + 1) & (IndexSize - 1);
+    }
+    return slot;
+}
+
+#endif // STATICORDEREDMAP_H
@@ -2,11 +2,21 @@ QT -= gui
 SOURCES = \
     testorderedmap.cpp
 
+INCLUDEPATH += $$PWD/../../examples/lrucache
+
 greaterThan(QT_MAJOR_VERSION, 4) {
-QT += testlib
+QT += testlib concurrent
 CONFIG += c++11
 } else {
 CONFIG  += qtestlib
 }
 
+# Exercise the optional operation statistics as well
+DEFINES += ORDEREDMAP_ENABLE_STATS
+
+# Qt 6 needs C++17
+greaterThan(QT_MAJOR_VERSION, 5) {
+CONFIG += c++17
+}
+
 include (../../src/src.pri)
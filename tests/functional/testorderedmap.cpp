@@ -1,8 +1,21 @@
 #include <QtTest/QtTest>
+#include <QBuffer>
 #include <QString>
+#include <QTemporaryFile>
 #include <QDebug>
 
+#include "concurrentorderedmap.h"
+#include "lrucache.h"
 #include "orderedmap.h"
+#include "orderedmapconcurrent.h"
+#include "orderedmapdiff.h"
+#include "orderedmaphash.h"
+#include "orderedmapjournal.h"
+#include "orderedmapview.h"
+#include "orderedset.h"
+#include "orderedstringmap.h"
+#include "persistentorderedmap.h"
+#include "staticorderedmap.h"
 
 class TestOrderedMap: public QObject
 {
@@ -31,13 +44,39 @@ private slots:
     void opEqualityTest();
     void opInequalityTest();
     void opSqrBracesTest();
+#ifdef ORDEREDMAP_ENABLE_STATS
+    void statsTest();
+#endif
+    void dataStreamTest();
+    void snapshotViewTest();
+    void journalTest();
+    void diffTest();
+    void positionalAccessTest();
+    void smallMapTest();
+    void sortTest();
+    void customHashTest();
+    void orderedSetTest();
+    void orderedStringMapTest();
+    void staticOrderedMapTest();
+    void concurrentTest();
+    void snapshotIsolationTest();
+    void concurrentSnapshotTest();
+    void lruCacheSupersededLoadTest();
+    void persistentOrderedMapTest();
+#ifdef Q_COMPILER_RANGE_FOR
+    void viewsTest();
+#endif
 
     // Iterator tests
     void insertTest();
+    void bulkInsertTest();
     void beginTest();
     void endTest();
     void findTest();
+    void findManyTest();
     void eraseTest();
+    void rangeEraseTest();
+    void extractSpliceTest();
     void iterationOrderTest();
     void foreachTest();
     void iteratorOperatorsTest();
@@ -433,6 +472,30 @@ void TestOrderedMap::opEqualityTest()
     om3.insert(1,1);
 
     QVERIFY(om1 == om3);
+
+    // Same entries, with holes in different places
+    OrderedMap<int, int> big1, big2;
+    for (int i = 0; i < 100; i++) {
+        big1.insert(i, i);
+        big2.insert(-1 - i, 0);
+        big2.insert(i, i);
+    }
+    for (int i = 0; i < 100; i++) {
+        big2.remove(-1 - i);
+    }
+    big1.remove(50);
+    big2.remove(50);
+    QVERIFY(big1 == big2);
+
+    OrderedMap<int, int> shared = big1;
+    QVERIFY(shared == big1);
+
+    big2[99] = 0;
+    QVERIFY(!(big1 == big2));
+    big2[99] = 99;
+    QVERIFY(big1 == big2);
+    big2.insert(0, 0);
+    QVERIFY(!(big1 == big2));
 }
 
 void TestOrderedMap::opInequalityTest()
@@ -471,6 +534,1166 @@ void TestOrderedMap::opSqrBracesTest()
     QVERIFY(om.size() == 4);
 }
 
+#ifdef ORDEREDMAP_ENABLE_STATS
+void TestOrderedMap::statsTest()
+{
+    OrderedMap<int, int> om;
+    om.insert(1,1);
+    om.insert(2,2);
+    om.insert(1,10);
+
+    QVERIFY(om.contains(1));
+    QVERIFY(!om.contains(3));
+    QVERIFY(om.value(2) == 2);
+    QVERIFY(om.value(4, 4) == 4);
+    QVERIFY(om.find(5) == om.end());
+    om[6] = 6;
+
+    OrderedMapStats stats = om.stats();
+    QVERIFY(stats.inserts == 3);
+    QVERIFY(stats.overwrites == 1);
+    QVERIFY(stats.relinks == 1);
+    QVERIFY(stats.hits == 2);
+    QVERIFY(stats.misses == 4);
+    QVERIFY(stats.evictions == 0);
+    QVERIFY(stats.averageChainLength > 0);
+
+    om.resetStats();
+    stats = om.stats();
+    QVERIFY(stats.inserts == 0);
+    QVERIFY(stats.hits == 0);
+    QVERIFY(stats.misses == 0);
+}
+#endif
+
+void TestOrderedMap::dataStreamTest()
+{
+    OrderedMap<QString, int> om1;
+    om1.insert(QString("c"),3);
+    om1.insert(QString("a"),1);
+    om1.insert(QString("b"),2);
+    om1.insert(QString("c"),30);
+
+    QByteArray bytes;
+    {
+        QDataStream out(&bytes, QIODevice::WriteOnly);
+        out << om1;
+    }
+
+    OrderedMap<QString, int> om2;
+    om2.insert(QString("z"),26);
+    {
+        QDataStream in(bytes);
+        in >> om2;
+        QVERIFY(in.status() == QDataStream::Ok);
+    }
+
+    QVERIFY(om2.size() == 3);
+    QVERIFY(!om2.contains(QString("z")));
+    QVERIFY(om2.value(QString("c")) == 30);
+
+    QString ans[] = {QString("a"), QString("b"), QString("c")};
+    int i = 0;
+    foreach (const QString &k, om2.keys()) {
+        QVERIFY(k == ans[i++]);
+    }
+
+    // Truncated input leaves an empty map
+    QDataStream truncated(bytes.left(bytes.size() - 2));
+    truncated >> om2;
+    QVERIFY(truncated.status() != QDataStream::Ok);
+    QVERIFY(om2.isEmpty());
+
+    // So does a huge count with no entries behind it
+    QByteArray huge;
+    {
+        QDataStream out(&huge, QIODevice::WriteOnly);
+        out << quint32(0xffffffff);
+    }
+    QDataStream hugeIn(huge);
+    hugeIn >> om2;
+    QVERIFY(hugeIn.status() != QDataStream::Ok);
+    QVERIFY(om2.isEmpty());
+}
+
+// Overwrites size bytes at pos in a copy of snapshot, then tries to open it
+static bool opensPatched(const QByteArray &snapshot, quint64 pos, quint64 value, int size)
+{
+    QByteArray patched = snapshot;
+    memcpy(patched.data() + pos, &value, size);
+    OrderedMapView<QString, int> view;
+    return view.setRawData(reinterpret_cast<const uchar *>(patched.constData()), patched.size());
+}
+
+void TestOrderedMap::snapshotViewTest()
+{
+    OrderedMap<QString, int> om;
+    for (int i = 0; i < 100; i++) {
+        om.insert(QString::number(i), i);
+    }
+    om.insert(QString("10"), 1000);
+    om.remove(QString("20"));
+
+    QTemporaryFile file;
+    QVERIFY(file.open());
+    QVERIFY((OrderedMapView<QString, int>::write(om, &file)));
+    file.close();
+
+    OrderedMapView<QString, int> view;
+    QVERIFY(view.open(file.fileName()));
+    QVERIFY(view.size() == om.size());
+    QVERIFY(view.contains(QString("10")));
+    QVERIFY(!view.contains(QString("20")));
+    QVERIFY(view.value(QString("10")) == 1000);
+    QVERIFY(view.value(QString("99")) == 99);
+    QVERIFY(view.value(QString("200"), -1) == -1);
+    QVERIFY(view.find(QString("20")) == view.end());
+    QVERIFY(view.find(QString("5")).value() == 5);
+
+    // Same order as the map, last re-inserted key at the end
+    OrderedMap<QString, int>::const_iterator mit = om.begin();
+    OrderedMapView<QString, int>::const_iterator vit = view.begin();
+    for (; vit != view.end(); ++vit, ++mit) {
+        QVERIFY(vit.key() == mit.key());
+        QVERIFY(vit.value() == mit.value());
+    }
+    QVERIFY(view.keyAt(view.size() - 1) == QString("10"));
+
+    // Mismatched key or value types are rejected, even of the same size
+    OrderedMapView<int, QString> wrongTypes;
+    QVERIFY(!wrongTypes.open(file.fileName()));
+    OrderedMapView<QString, float> floats;
+    QVERIFY(!floats.open(file.fileName()));
+    OrderedMapView<QString, uint> unsignedInts;
+    QVERIFY(!unsignedInts.open(file.fileName()));
+
+    // So are tables and entries that point outside the data
+    QByteArray snapshot;
+    QBuffer snapshotBuffer(&snapshot);
+    snapshotBuffer.open(QIODevice::WriteOnly);
+    QVERIFY((OrderedMapView<QString, int>::write(om, &snapshotBuffer)));
+    quint64 count, offsetsOffset, indexOffset, firstEntry;
+    memcpy(&count, snapshot.constData() + 24, sizeof(quint64));
+    memcpy(&offsetsOffset, snapshot.constData() + 40, sizeof(quint64));
+    memcpy(&indexOffset, snapshot.constData() + 48, sizeof(quint64));
+    memcpy(&firstEntry, snapshot.constData() + offsetsOffset, sizeof(quint64));
+    quint64 usedSlot = indexOffset;
+    for (quint32 entry = 0; entry == 0; usedSlot += 2 * sizeof(quint32)) {
+        memcpy(&entry, snapshot.constData() + usedSlot + sizeof(quint32), sizeof(quint32));
+    }
+    usedSlot -= 2 * sizeof(quint32);
+
+    QVERIFY(opensPatched(snapshot, offsetsOffset, firstEntry, sizeof(quint64)));
+    QVERIFY(!opensPatched(snapshot, offsetsOffset + sizeof(quint64), snapshot.size(), sizeof(quint64)));
+    QVERIFY(!opensPatched(snapshot, offsetsOffset + sizeof(quint64), firstEntry, sizeof(quint64)));
+    QVERIFY(!opensPatched(snapshot, usedSlot + sizeof(quint32), count + 1, sizeof(quint32)));
+    QVERIFY(!opensPatched(snapshot, usedSlot + sizeof(quint32), 0, sizeof(quint32)));
+    QVERIFY(!opensPatched(snapshot, firstEntry, 0x7fffffff, sizeof(quint32)));
+    OrderedMapView<QString, int> truncated;
+    QVERIFY(!truncated.setRawData(reinterpret_cast<const uchar *>(snapshot.constData()), snapshot.size() - 8));
+
+    view.close();
+    QVERIFY(!view.isOpen());
+    QVERIFY(view.isEmpty());
+
+    OrderedMap<int, QByteArray> empty;
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    QVERIFY((OrderedMapView<int, QByteArray>::write(empty, &buffer)));
+    OrderedMapView<int, QByteArray> emptyView;
+    QVERIFY(emptyView.setRawData(reinterpret_cast<const uchar *>(bytes.constData()), bytes.size()));
+    QVERIFY(emptyView.isEmpty());
+    QVERIFY(!emptyView.contains(1));
+}
+
+void TestOrderedMap::diffTest()
+{
+    OrderedMap<QString, int> from;
+    from.insert(QString("a"), 1);
+    from.insert(QString("b"), 2);
+    from.insert(QString("c"), 3);
+    from.insert(QString("d"), 4);
+    from.insert(QString("e"), 5);
+
+    // A copy still sharing its data is equal without a look at the entries
+    OrderedMap<QString, int> to = from;
+    QVERIFY(diff(from, to).isEmpty());
+
+    to.remove(QString("b"));
+    to.insert(QString("f"), 6);
+    to[QString("c")] = 30;
+    to.insert(QString("a"), 1);
+    to[QString("e")] = 50;
+
+    OrderedMapDiff<QString, int> changes = diff(from, to);
+    QVERIFY(changes.removed == QList<QString>() << QString("b"));
+    // c, d and e keep their place, a moved to the end
+    QVERIFY(changes.changed.keys() == QList<QString>() << QString("c") << QString("e"));
+    QVERIFY(changes.changed.value(QString("e")) == 50);
+    QVERIFY(changes.moved.keys() == QList<QString>() << QString("a"));
+    QVERIFY(changes.movedTo == QList<int>() << 4);
+    QVERIFY(changes.added.keys() == QList<QString>() << QString("f"));
+    QVERIFY(changes.addedAt == QList<int>() << 3);
+
+    // Shipped as a stream to a client holding the older map
+    QByteArray bytes;
+    {
+        QDataStream out(&bytes, QIODevice::WriteOnly);
+        out << changes;
+    }
+    OrderedMapDiff<QString, int> received;
+    {
+        QDataStream in(bytes);
+        in >> received;
+        QVERIFY(in.status() == QDataStream::Ok);
+    }
+
+    OrderedMap<QString, int> client = from;
+    applyDiff(client, received);
+    QVERIFY(client == to);
+    QVERIFY(client.keys() == to.keys());
+    QVERIFY(diff(client, to).isEmpty());
+
+    // Moving one key to the front moves only that key
+    OrderedMap<QString, int> rotated = from;
+    rotated.remove(QString("e"));
+    OrderedMap<QString, int> front;
+    front.insert(QString("e"), 5);
+    front.insert(rotated);
+    changes = diff(from, front);
+    QVERIFY(changes.changed.isEmpty() && changes.added.isEmpty() && changes.removed.isEmpty());
+    QVERIFY(changes.moved.keys() == QList<QString>() << QString("e"));
+    QVERIFY(changes.movedTo == QList<int>() << 0);
+    client = from;
+    applyDiff(client, changes);
+    QVERIFY(client.keys() == front.keys());
+
+    // Against an empty map, everything is added or removed
+    OrderedMap<QString, int> empty;
+    QVERIFY(diff(empty, to).added == to);
+    QVERIFY(diff(to, empty).removed == to.keys());
+}
+
+void TestOrderedMap::journalTest()
+{
+    OrderedMapJournal<int, QString> journal;
+    OrderedMap<int, QString> om, replica;
+    om.insert(0, QString("0"));
+    om.setJournal(&journal);
+    QVERIFY(om.journal() == &journal);
+
+    om.insert(1, QString("1"));
+    om.insert(2, QString("2"));
+    om.insert(0, QString("zero"));
+    om.remove(1);
+    om.remove(5);
+    QVERIFY(om.take(2) == QString("2"));
+    om.insert(3, QString("3"));
+    om.erase(om.begin());
+
+    QVERIFY(journal.size() == 7);
+    QVERIFY(journal.lastSequence() == 7);
+    QVERIFY((journal.entries().at(2).operation == OrderedMapJournal<int, QString>::Overwrite));
+
+    QByteArray batch;
+    {
+        QDataStream out(&batch, QIODevice::WriteOnly);
+        journal.drain(out);
+    }
+    QVERIFY(journal.isEmpty());
+
+    // The replica starts from the state before the journal was attached
+    replica.insert(0, QString("0"));
+    quint64 applied = 0;
+    {
+        QDataStream in(batch);
+        QVERIFY((OrderedMapJournal<int, QString>::replay(in, replica, &applied)));
+    }
+    QVERIFY(applied == 7);
+    QVERIFY(replica == om);
+
+    // A second batch, with a whole-map replacement in it
+    OrderedMap<int, QString> other;
+    other.insert(7, QString("7"));
+    other.insert(8, QString("8"));
+    om.insert(4, QString("4"));
+    om = other;
+    om.clear();
+    om.insert(9, QString("9"));
+
+    QByteArray batch2;
+    {
+        QDataStream out(&batch2, QIODevice::WriteOnly);
+        journal.drain(out);
+    }
+    {
+        QDataStream in(batch2);
+        QVERIFY((OrderedMapJournal<int, QString>::replay(in, replica, &applied)));
+    }
+    QVERIFY(replica == om);
+    QVERIFY(replica.keys() == QList<int>() << 9);
+
+    // Replaying an already applied batch changes nothing
+    {
+        QDataStream in(batch);
+        QVERIFY((OrderedMapJournal<int, QString>::replay(in, replica, &applied)));
+    }
+    QVERIFY(replica == om);
+
+    om.setJournal(NULL);
+    om.insert(10, QString("10"));
+    QVERIFY(journal.isEmpty());
+}
+
+void TestOrderedMap::staticOrderedMapTest()
+{
+    StaticOrderedMap<int, QString, 4> om;
+    QVERIFY(om.capacity() == 4);
+    QVERIFY(om.isEmpty());
+    QVERIFY(om.begin() == om.end());
+
+    for (int i = 0; i < 4; ++i) {
+        QVERIFY(om.insert(i, QString::number(i)));
+    }
+    QVERIFY(om.isFull());
+
+    // A new key is rejected when full, an existing one still moves to the end
+    QVERIFY(!om.insert(4, QString("4")));
+    QVERIFY(!om.contains(4));
+    QVERIFY(om.insert(1, QString("one")));
+    QVERIFY(om.size() == 4);
+
+    QList<int> keys;
+    for (StaticOrderedMap<int, QString, 4>::const_iterator it = om.begin(); it != om.end(); ++it) {
+        keys.append(it.key());
+    }
+    QList<int> expected;
+    expected << 0 << 2 << 3 << 1;
+    QVERIFY(keys == expected);
+    QVERIFY(om.value(1) == QString("one"));
+
+    // Removing from the middle leaves room that later inserts reuse
+    QVERIFY(om.remove(2) == 1);
+    QVERIFY(om.take(0) == QString("0"));
+    QVERIFY(om.insert(5, QString("5")));
+    QVERIFY(om.insert(6, QString("6")));
+    QVERIFY(!om.insert(7, QString("7")));
+    keys.clear();
+    for (StaticOrderedMap<int, QString, 4>::iterator it = om.begin(); it != om.end(); ++it) {
+        keys.append(it.key());
+    }
+    expected.clear();
+    expected << 3 << 1 << 5 << 6;
+    QVERIFY(keys == expected);
+
+    StaticOrderedMap<int, QString, 4>::iterator it = om.erase(om.find(1));
+    QVERIFY(it.key() == 5);
+    QVERIFY(om.size() == 3);
+    om.clear();
+    QVERIFY(om.isEmpty());
+    QVERIFY(om.value(3, QString("none")) == QString("none"));
+
+    // Evicting keeps the newest entries
+    StaticOrderedMap<int, int, 3, EvictOldestWhenFull> recent;
+    for (int i = 0; i < 10; ++i) {
+        QVERIFY(recent.insert(i, i * i));
+    }
+    QVERIFY(recent.size() == 3);
+    QVERIFY(!recent.contains(6));
+    QVERIFY(recent.value(7) == 49);
+    QVERIFY(recent.begin().key() == 7);
+
+    StaticOrderedMap<int, int, 3, EvictOldestWhenFull> same = recent;
+    QVERIFY(same == recent);
+    same.insert(8, 0);
+    QVERIFY(same != recent);
+
+    // Keys and values may refer to the entries that inserting clears
+    StaticOrderedMap<QString, QString, 3, EvictOldestWhenFull> names;
+    names.insert(QString("a"), QString("A"));
+    names.insert(QString("b"), QString("B"));
+    names.insert(QString("c"), QString("C"));
+    StaticOrderedMap<QString, QString, 3, EvictOldestWhenFull>::iterator first = names.begin();
+    QVERIFY(names.insert(first.key(), first.value()));
+    QVERIFY(names.value(QString("a")) == QString("A"));
+    QVERIFY(names.begin().key() == QString("b"));
+
+    // The head is evicted to make room
+    first = names.begin();
+    QVERIFY(names.insert(first.value(), first.key()));
+    QVERIFY(names.size() == 3);
+    QVERIFY(!names.contains(QString("b")));
+    QVERIFY(names.value(QString("B")) == QString("b"));
+    QVERIFY(names.value(QString("a")) == QString("A"));
+    QList<QString> nameKeys;
+    for (StaticOrderedMap<QString, QString, 3, EvictOldestWhenFull>::const_iterator it = names.begin(); it != names.end(); ++it) {
+        nameKeys.append(it.key());
+    }
+    QVERIFY(nameKeys == (QList<QString>() << "c" << "a" << "B"));
+}
+
+static int valueLength(const int &, const QString &value)
+{
+    return value.size();
+}
+
+static bool isMultipleOfThree(const int &key, const QString &)
+{
+    return key % 3 == 0;
+}
+
+static void addKey(qint64 &sum, const int &key, const QString &)
+{
+    sum += key;
+}
+
+static void addSum(qint64 &sum, const qint64 &chunkSum)
+{
+    sum += chunkSum;
+}
+
+// Collects the keys, to check that chunk results are merged in order
+static void appendKey(QList<int> &keys, const int &key, const QString &)
+{
+    keys.append(key);
+}
+
+static void appendKeys(QList<int> &keys, const QList<int> &chunkKeys)
+{
+    keys.append(chunkKeys);
+}
+
+// One thread of concurrentTest(), reading every tenth entry of a shared map by index
+struct PositionalRead
+{
+    const OrderedMap<int, QString> *map;
+    const QList<int> *keys;
+    int first;
+    bool matched;
+};
+
+static void readPositions(PositionalRead &read)
+{
+    read.matched = true;
+    for (int i = read.first; i < read.keys->size(); i += 10) {
+        if (read.map->keyAt(i) != read.keys->at(i) || read.map->indexOf(read.keys->at(i)) != i) {
+            read.matched = false;
+        }
+    }
+}
+
+void TestOrderedMap::concurrentTest()
+{
+    // Large enough to be split into several chunks, with holes in between
+    OrderedMap<int, QString> om;
+    for (int i = 0; i < 50000; ++i) {
+        om.insert(i, QString::number(i));
+    }
+    for (int i = 0; i < 50000; i += 7) {
+        om.remove(i);
+    }
+    om.insert(7, QString("seven"));
+
+    OrderedMap<int, int> lengths = OrderedMapConcurrent::mapValues<int>(om, valueLength);
+    QVERIFY(lengths.size() == om.size());
+    QVERIFY(lengths.keys() == om.keys());
+    QVERIFY(lengths.value(7) == 5);
+    QVERIFY(lengths.value(12345) == 5);
+    QVERIFY(!lengths.contains(14));
+    lengths.insert(14, 2);
+    QVERIFY(lengths.keyAt(lengths.size() - 1) == 14);
+    QVERIFY(!om.contains(14));
+
+    OrderedMap<int, QString> multiples = OrderedMapConcurrent::filtered(om, isMultipleOfThree);
+    QList<int> expected;
+    for (OrderedMap<int, QString>::const_iterator it = om.begin(); it != om.end(); ++it) {
+        if (it.key() % 3 == 0) {
+            expected.append(it.key());
+        }
+    }
+    QVERIFY(multiples.keys() == expected);
+    QVERIFY(multiples.value(3) == QString("3"));
+    QVERIFY(!multiples.contains(7));
+
+    qint64 sum = 0;
+    QList<int> keys = om.keys();
+    for (int i = 0; i < keys.size(); ++i) {
+        sum += keys.at(i);
+    }
+    QVERIFY(OrderedMapConcurrent::reduce(om, qint64(0), addKey, addSum) == sum);
+    QVERIFY(OrderedMapConcurrent::reduce(om, QList<int>(), appendKey, appendKeys) == keys);
+
+    // Positional reads write nothing, even with holes, so threads can share a map
+    const OrderedMap<int, QString> shared = om;
+    QVector<PositionalRead> reads;
+    for (int i = 0; i < 10; ++i) {
+        PositionalRead read = { &shared, &keys, i, false };
+        reads.append(read);
+    }
+    QtConcurrent::blockingMap(reads, readPositions);
+    for (int i = 0; i < reads.size(); ++i) {
+        QVERIFY(reads[i].matched);
+    }
+
+    OrderedMap<int, QString> empty;
+    QVERIFY(OrderedMapConcurrent::mapValues<int>(empty, valueLength).isEmpty());
+    QVERIFY(OrderedMapConcurrent::filtered(empty, isMultipleOfThree).isEmpty());
+    QVERIFY(OrderedMapConcurrent::reduce(empty, qint64(0), addKey, addSum) == 0);
+}
+
+// Appends an entry to a version being built by ConcurrentOrderedMap::update()
+struct AppendEntry
+{
+    int key;
+
+    void operator()(OrderedMap<int, QString> &map) const
+    {
+        map.insert(key, QString::number(key));
+    }
+};
+
+void TestOrderedMap::snapshotIsolationTest()
+{
+    ConcurrentOrderedMap<int, QString> shared;
+    QVERIFY(shared.snapshot().isEmpty());
+
+    OrderedMap<int, QString> om;
+    om.insert(2, QString("2"));
+    om.insert(1, QString("1"));
+    shared.publish(om);
+
+    const OrderedMap<int, QString> before = shared.snapshot();
+    AppendEntry append = { 3 };
+    shared.update(append);
+    append.key = 2;
+    shared.update(append);
+
+    // Earlier snapshots keep seeing the version they were taken from
+    QList<int> expected;
+    expected << 2 << 1;
+    QVERIFY(before.keys() == expected);
+
+    const OrderedMap<int, QString> after = shared.snapshot();
+    expected.clear();
+    expected << 1 << 3 << 2;
+    QVERIFY(after.keys() == expected);
+
+    // Snapshots are private copies, and the published map was copied too
+    OrderedMap<int, QString> mine = shared.snapshot();
+    mine.remove(1);
+    om.insert(4, QString("4"));
+    QVERIFY(shared.snapshot() == after);
+}
+
+// One thread of concurrentSnapshotTest()
+struct SnapshotWorker
+{
+    ConcurrentOrderedMap<int, QString> *shared;
+    bool writer;
+    bool consistent;
+};
+
+// Every version the writer publishes holds the keys 0 to size - 1 in order
+static bool isWrittenVersion(const OrderedMap<int, QString> &map)
+{
+    int expected = 0;
+    for (OrderedMap<int, QString>::const_iterator it = map.begin(); it != map.end(); ++it, ++expected) {
+        if (it.key() != expected || it.value() != QString::number(expected)) {
+            return false;
+        }
+    }
+    return expected == map.size();
+}
+
+/* The writer keeps appending entries, while readers take snapshots and check
+ * that every one is a whole version, never older than the one before, and
+ * that the one before is still intact after later versions replaced it.
+ */
+static void runSnapshotWorker(SnapshotWorker &worker)
+{
+    enum { Rounds = 2000 };
+
+    worker.consistent = true;
+    if (worker.writer) {
+        for (int i = 0; i < Rounds; ++i) {
+            AppendEntry append = { i };
+            worker.shared->update(append);
+        }
+        return;
+    }
+
+    OrderedMap<int, QString> previous = worker.shared->snapshot();
+    for (int i = 0; i < Rounds && worker.consistent; ++i) {
+        OrderedMap<int, QString> current = worker.shared->snapshot();
+        worker.consistent = isWrittenVersion(current)
+                            && current.size() >= previous.size()
+                            && isWrittenVersion(previous);
+        previous = current;
+    }
+}
+
+void TestOrderedMap::concurrentSnapshotTest()
+{
+    ConcurrentOrderedMap<int, QString> shared;
+
+    QVector<SnapshotWorker> workers;
+    for (int i = 0; i < 4; ++i) {
+        SnapshotWorker worker = { &shared, i == 0, false };
+        workers.append(worker);
+    }
+    QtConcurrent::blockingMap(workers, runSnapshotWorker);
+
+    for (int i = 0; i < workers.size(); ++i) {
+        QVERIFY(workers[i].consistent);
+    }
+    QVERIFY(shared.snapshot().size() == 2000);
+    QVERIFY(isWrittenVersion(shared.snapshot()));
+}
+
+// Loads value for any key, once gate is open
+struct GatedLoader
+{
+    QAtomicInt *gate;
+    QString value;
+
+    bool operator()(const int &, QString &loaded) const
+    {
+        while (!gate->loadAcquire()) {
+            QThread::yieldCurrentThread();
+        }
+        loaded = value;
+        return true;
+    }
+};
+
+void TestOrderedMap::lruCacheSupersededLoadTest()
+{
+    LruCache<int, QString> cache(8);
+    QAtomicInt gate(0);
+    QAtomicInt open(1);
+    GatedLoader slow = { &gate, QString("stale") };
+    GatedLoader fast = { &open, QString("new") };
+
+    QFuture<QString> cleared = cache.getOrCompute(3, slow);
+    cache.clear();
+    QFuture<QString> inserted = cache.getOrCompute(1, slow);
+    cache.insert(1, QString("fresh"));
+    QFuture<QString> removed = cache.getOrCompute(2, slow);
+    cache.remove(2);
+    // A miss after the load was superseded starts a new one
+    QFuture<QString> reloaded = cache.getOrCompute(2, fast);
+
+    gate.storeRelease(1);
+    cleared.waitForFinished();
+    inserted.waitForFinished();
+    removed.waitForFinished();
+    reloaded.waitForFinished();
+
+    // Superseded loads still finish for their callers, but are not cached
+    QVERIFY(inserted.result() == QString("stale"));
+    QVERIFY(removed.result() == QString("stale"));
+    QVERIFY(cleared.result() == QString("stale"));
+    QVERIFY(reloaded.result() == QString("new"));
+    QVERIFY(cache.value(1) == QString("fresh"));
+    QVERIFY(cache.value(2) == QString("new"));
+    QVERIFY(!cache.contains(3));
+}
+
+void TestOrderedMap::persistentOrderedMapTest()
+{
+    typedef PersistentOrderedMap<int, QString> Map;
+
+    const Map empty;
+    QVERIFY(empty.isEmpty());
+    QVERIFY(empty.begin() == empty.end());
+
+    const Map one = empty.insert(1, QString("1"));
+    const Map two = one.insert(2, QString("2"));
+    const Map three = two.insert(3, QString("3"));
+    QVERIFY(empty.isEmpty());
+    QVERIFY(one.size() == 1);
+    QVERIFY(two.size() == 2);
+    QVERIFY(three.size() == 3);
+
+    // Overwriting moves the key to the end, in the new version only
+    const Map moved = three.insert(1, QString("one"));
+    QList<int> expected;
+    expected << 2 << 3 << 1;
+    QVERIFY(moved.keys() == expected);
+    QVERIFY(moved.value(1) == QString("one"));
+    QVERIFY(moved.keyAt(2) == 1);
+    QVERIFY(moved.at(0) == QString("2"));
+    expected.clear();
+    expected << 1 << 2 << 3;
+    QVERIFY(three.keys() == expected);
+    QVERIFY(three.value(1) == QString("1"));
+
+    const Map removed = moved.remove(3);
+    QVERIFY(!removed.contains(3));
+    QVERIFY(moved.contains(3));
+    QVERIFY(removed.remove(3) == removed);
+    QVERIFY(removed.value(3, QString("none")) == QString("none"));
+    QVERIFY(removed.find(3) == removed.end());
+    QVERIFY(removed.find(2).value() == QString("2"));
+
+    // Many versions, each one entry apart, all stay intact
+    QList<Map> versions;
+    Map map;
+    for (int i = 0; i < 2000; i++) {
+        versions.append(map);
+        map = map.insert(i, QString::number(i));
+        if (i % 3 == 0) {
+            map = map.remove(i / 2);
+        }
+    }
+    for (int i = 0; i < versions.size(); i += 97) {
+        const Map &version = versions.at(i);
+        int pos = 0;
+        for (Map::const_iterator it = version.begin(); it != version.end(); ++it) {
+            QVERIFY(it.key() < i);
+            QVERIFY(it.value() == QString::number(it.key()));
+            QVERIFY(version.keyAt(pos++) == it.key());
+        }
+        QVERIFY(pos == version.size());
+    }
+
+    // Converts both ways, keeping order and values
+    OrderedMap<int, QString> om = map.toOrderedMap();
+    QVERIFY(om.keys() == map.keys());
+    QVERIFY(om.values() == map.values());
+    const Map back(om);
+    QVERIFY(back == map);
+    QVERIFY(back != map.remove(map.keyAt(0)));
+}
+
+// Odd keys first, each half in descending order
+static bool oddFirstDescending(const int &key1, const QString &, const int &key2, const QString &)
+{
+    if ((key1 & 1) != (key2 & 1)) {
+        return key1 & 1;
+    }
+    return key1 > key2;
+}
+
+static bool longerFirst(const QString &value1, const QString &value2)
+{
+    return value1.size() > value2.size();
+}
+
+void TestOrderedMap::sortTest()
+{
+    OrderedMap<QString, int> scores;
+    scores.insert(QString("carol"), 3);
+    scores.insert(QString("alice"), 5);
+    scores.insert(QString("bob"), 1);
+    scores.insert(QString("dave"), 3);
+    scores.remove(QString("alice"));
+    scores.insert(QString("alice"), 5);
+
+    scores.sortByValue();
+    // Stable, so carol stays ahead of dave
+    QList<QString> expected;
+    expected << QString("bob") << QString("carol") << QString("dave") << QString("alice");
+    QVERIFY(scores.keys() == expected);
+    QVERIFY(scores.value(QString("dave")) == 3);
+    QVERIFY(scores.indexOf(QString("alice")) == 3);
+
+    scores.sortByKey();
+    expected.clear();
+    expected << QString("alice") << QString("bob") << QString("carol") << QString("dave");
+    QVERIFY(scores.keys() == expected);
+
+    // Inserting after a sort still appends
+    scores.insert(QString("aaron"), 0);
+    QVERIFY(scores.keyAt(4) == QString("aaron"));
+
+    OrderedMap<int, QString> om;
+    for (int i = 0; i < 20000; ++i) {
+        om.insert(i, QString::number(i));
+    }
+    for (int i = 0; i < 20000; i += 3) {
+        om.remove(i);
+    }
+    OrderedMap<int, QString> parallel = om;
+
+    om.sort(oddFirstDescending);
+    QVERIFY(om.size() == parallel.size());
+    QVERIFY(om.keyAt(0) == 19999);
+    QVERIFY(om.keyAt(om.size() - 1) == 2);
+    for (int i = 1; i < om.size(); ++i) {
+        QVERIFY(!oddFirstDescending(om.keyAt(i), QString(), om.keyAt(i - 1), QString()));
+    }
+    QVERIFY(om.value(19997) == QString("19997"));
+    QVERIFY(!om.contains(3));
+
+    OrderedMapConcurrent::sort(parallel, oddFirstDescending);
+    QVERIFY(parallel.keys() == om.keys());
+    QVERIFY(parallel.value(4) == QString("4"));
+
+    // Equal lengths keep the order of the previous sort
+    om.sortByValue(longerFirst);
+    QVERIFY(om.keyAt(0) == 19999);
+    QVERIFY(om.keyAt(om.size() - 1) == 2);
+}
+
+struct CaseInsensitiveHash
+{
+    uint operator()(const QString &key) const
+    {
+        return qHash(key.toLower());
+    }
+};
+
+struct CaseInsensitiveEqual
+{
+    bool operator()(const QString &key1, const QString &key2) const
+    {
+        return key1.toLower() == key2.toLower();
+    }
+};
+
+void TestOrderedMap::customHashTest()
+{
+    OrderedMap<QByteArray, int, OrderedMapFastHash> fast;
+    for (int i = 0; i < 1000; ++i) {
+        fast.insert(QByteArray::number(i), i);
+    }
+    for (int i = 0; i < 1000; i += 2) {
+        fast.remove(QByteArray::number(i));
+    }
+    fast.insert(QByteArray("1"), 100);
+    QVERIFY(fast.size() == 500);
+    QVERIFY(fast.value(QByteArray("999")) == 999);
+    QVERIFY(fast.value(QByteArray("1")) == 100);
+    QVERIFY(fast.keyAt(fast.size() - 1) == QByteArray("1"));
+    QVERIFY(!fast.contains(QByteArray("998")));
+
+    OrderedMap<QByteArray, int, OrderedMapFastHash> copy = fast;
+    QVERIFY(copy == fast);
+    copy.insert(QByteArray("new"), 0);
+    QVERIFY(copy != fast);
+
+    QByteArray data;
+    {
+        QDataStream out(&data, QIODevice::WriteOnly);
+        out << fast;
+    }
+    QDataStream in(data);
+    OrderedMap<QByteArray, int, OrderedMapFastHash> streamed;
+    in >> streamed;
+    QVERIFY(streamed == fast);
+
+    // Keys that only differ in case are the same key
+    OrderedMap<QString, int, CaseInsensitiveHash, CaseInsensitiveEqual> headers;
+    headers.insert(QString("Content-Type"), 1);
+    headers.insert(QString("Accept"), 2);
+    headers.insert(QString("content-type"), 3);
+    QVERIFY(headers.size() == 2);
+    QVERIFY(headers.value(QString("CONTENT-TYPE")) == 3);
+    QVERIFY(headers.keyAt(0) == QString("Accept"));
+    QVERIFY(headers.remove(QString("accept")) == 1);
+    QVERIFY(headers.size() == 1);
+
+    // Same bytes, same hash, wherever they are; every length differs
+    char buffer[256];
+    for (int i = 0; i < int(sizeof(buffer)); ++i) {
+        buffer[i] = char(i * 7);
+    }
+    QByteArray bytes(buffer + 1, 200);
+    OrderedSet<uint> hashes;
+    for (int size = 0; size <= 200; ++size) {
+        uint hash = oMHashBytes(bytes.constData(), size);
+        QVERIFY(hash == oMHashBytes(buffer + 1, size));
+        QVERIFY(hash != oMHashBytes(bytes.constData(), size, 1));
+        hashes.insert(hash);
+    }
+    QVERIFY(hashes.size() == 201);
+    QVERIFY(OrderedMapFastHash()(QByteArray("key")) == oMHashBytes("key", 3));
+}
+
+void TestOrderedMap::orderedStringMapTest()
+{
+    OrderedStringMap<int> osm;
+    QVERIFY(osm.isEmpty());
+
+    QString wide = QString("caf") + QChar(ushort(0x00e9)) + QChar(ushort(0x2615));
+    osm.insert(QString("b"), 2);
+    osm.insert(QString("a"), 1);
+    osm.insert(wide, 3);
+    osm.insert(QString("b"), 20);
+
+    QList<QString> expected;
+    expected << QString("a") << wide << QString("b");
+    QVERIFY(osm.keys() == expected);
+    QVERIFY(osm.value(QString("b")) == 20);
+    QVERIFY(osm.value(wide) == 3);
+    QVERIFY(osm.keyAt(1) == wide);
+    QVERIFY(osm.at(2) == 20);
+    QVERIFY(!osm.contains(QString("c")));
+    QVERIFY(osm.value(QString("c"), -1) == -1);
+    QVERIFY(osm.find(QString("a")).value() == 1);
+    QVERIFY(osm.find(QString("c")) == osm.end());
+
+    // A Latin-1 key and a UTF-8 key with the same bytes stay apart
+    QString latin1 = QString(QChar(ushort(0x00c3))) + QChar(ushort(0x00a9));
+    osm.insert(latin1, 4);
+    osm.insert(QString(QChar(ushort(0x00e9))), 5);
+    QVERIFY(osm.value(latin1) == 4);
+    QVERIFY(osm.value(QString(QChar(ushort(0x00e9)))) == 5);
+
+    // Copies share the stored keys, but change independently
+    OrderedStringMap<int> copy = osm;
+    copy.insert(QString("copy"), 6);
+    osm.insert(QString("original"), 7);
+    QVERIFY(!osm.contains(QString("copy")));
+    QVERIFY(!copy.contains(QString("original")));
+    QVERIFY(copy.take(QString("copy")) == 6);
+    QVERIFY(osm.remove(QString("original")) == 1);
+    QVERIFY(osm.remove(QString("original")) == 0);
+    QVERIFY(copy == osm);
+
+    // Removing most keys reclaims their bytes, keeping the rest intact
+    OrderedStringMap<int> many;
+    for (int i = 0; i < 5000; ++i) {
+        many.insert(QString("key %1").arg(i), i);
+    }
+    for (int i = 0; i < 5000; ++i) {
+        if (i % 10) {
+            many.remove(QString("key %1").arg(i));
+        }
+    }
+    QVERIFY(many.size() == 500);
+    QVERIFY(many.keyAt(0) == QString("key 0"));
+    QVERIFY(many.value(QString("key 4990")) == 4990);
+    QVERIFY(!many.contains(QString("key 4991")));
+    int i = 0;
+    for (OrderedStringMap<int>::const_iterator it = many.begin(); it != many.end(); ++it, i += 10) {
+        QVERIFY(it.key() == QString("key %1").arg(i));
+        QVERIFY(*it == i);
+    }
+
+    osm.clear();
+    QVERIFY(osm.isEmpty());
+    QVERIFY(osm.begin() == osm.end());
+}
+
+void TestOrderedMap::positionalAccessTest()
+{
+    OrderedMap<int, int> om;
+    QList<int> order;
+    for (int i = 0; i < 100; ++i) {
+        om.insert(i, i * 10);
+        order.append(i);
+    }
+
+    QVERIFY(om.at(0) == 0);
+    QVERIFY(om.keyAt(99) == 99);
+    QVERIFY(om.indexOf(42) == 42);
+    QVERIFY(om.indexOf(100) == -1);
+
+    // Removals leave holes, positions must still count live entries only
+    for (int i = 0; i < 100; i += 3) {
+        om.remove(i);
+        order.removeOne(i);
+    }
+    om.insert(1, 1);
+    order.removeOne(1);
+    order.append(1);
+
+    QVERIFY(om.size() == order.size());
+    for (int i = 0; i < order.size(); ++i) {
+        QVERIFY(om.keyAt(i) == order.at(i));
+        QVERIFY(om.indexOf(order.at(i)) == i);
+    }
+    QVERIFY(om.at(order.size() - 1) == 1);
+
+    OrderedMap<int, int>::iterator it = om.begin() + 20;
+    QVERIFY(it.key() == order.at(20));
+    QVERIFY((it - 15).key() == order.at(5));
+    QVERIFY(it - om.begin() == 20);
+    QVERIFY(om.end() - om.begin() == om.size());
+    QVERIFY(om.begin() < it);
+    QVERIFY(om.begin() + om.size() == om.end());
+
+    // Enough removals to compact the storage
+    for (int i = 0; i < 60; ++i) {
+        om.remove(order.takeFirst());
+    }
+    om.insert(1000, 1000);
+    order.append(1000);
+    om.squeeze();
+
+    QVERIFY(om.size() == order.size());
+    QVERIFY(om.keys() == order);
+    for (int i = 0; i < order.size(); ++i) {
+        QVERIFY(om.keyAt(i) == order.at(i));
+        QVERIFY(om.value(order.at(i)) == om.at(i));
+    }
+}
+
+void TestOrderedMap::smallMapTest()
+{
+    // Small maps are scanned without an index; behaviour must not change
+    // when they grow past that size or shrink back below it
+    OrderedMap<int, QString> om;
+    for (int i = 0; i < 6; ++i) {
+        om.insert(i, QString::number(i));
+    }
+    om.insert(2, QString("two"));
+    QVERIFY(om.size() == 6);
+    QVERIFY(om.keyAt(5) == 2);
+    QVERIFY(om.value(2) == QString("two"));
+    QVERIFY(om.remove(0) == 1);
+    QVERIFY(!om.contains(0));
+    QVERIFY(om.indexOf(3) == 1);
+
+    for (int i = 10; i < 40; ++i) {
+        om.insert(i, QString::number(i));
+    }
+    QVERIFY(om.size() == 35);
+    QVERIFY(om.keyAt(4) == 2);
+    QVERIFY(om.value(25) == QString("25"));
+
+    for (int i = 10; i < 38; ++i) {
+        om.remove(i);
+    }
+    om.squeeze();
+    QVERIFY(om.size() == 7);
+    QList<int> expected;
+    expected << 1 << 3 << 4 << 5 << 2 << 38 << 39;
+    QVERIFY(om.keys() == expected);
+    QVERIFY(om.value(38) == QString("38"));
+    QVERIFY(!om.contains(10));
+
+    // Overwriting in place and relinking many times leaves no stale entries
+    for (int round = 0; round < 20; ++round) {
+        om.insert(1, QString::number(round));
+        om.insert(39, QString::number(round));
+    }
+    QVERIFY(om.size() == 7);
+    QVERIFY(om.keyAt(5) == 1);
+    QVERIFY(om.value(1) == QString("19"));
+
+    OrderedMap<int, QString> copy(om);
+    copy.insert(100, QString("100"));
+    QVERIFY(!om.contains(100));
+    QVERIFY(copy.size() == 8);
+
+    OrderedMap<int, QString> merged;
+    merged.insert(4, QString("four"));
+    merged.insert(7, QString("7"));
+    QList<std::pair<int, QString> > pairs;
+    pairs << std::make_pair(7, QString("seven")) << std::make_pair(8, QString("8"));
+    merged.insert(pairs.begin(), pairs.end());
+    QVERIFY(merged.size() == 3);
+    QVERIFY(merged.keyAt(1) == 7);
+    QVERIFY(merged.value(7) == QString("seven"));
+}
+
+void TestOrderedMap::orderedSetTest()
+{
+    OrderedSet<QString> set;
+    QVERIFY(set.insert("c"));
+    QVERIFY(set.insert("a"));
+    QVERIFY(set.insert("b"));
+    // Duplicates are rejected and keep their first position
+    QVERIFY(!set.insert("c"));
+    QVERIFY(set.size() == 3);
+    QVERIFY(set.toList() == (QList<QString>() << "c" << "a" << "b"));
+    QVERIFY(set.at(1) == QString("a"));
+    QVERIFY(set.indexOf("b") == 2);
+    QVERIFY(set.contains("a"));
+    QVERIFY(!set.contains("d"));
+
+    QList<QString> iterated;
+    for (OrderedSet<QString>::const_iterator it = set.begin(); it != set.end(); ++it) {
+        iterated.append(*it);
+    }
+    QVERIFY(iterated == set.values());
+
+    OrderedSet<QString> other;
+    other.insert("d");
+    other.insert("b");
+    other.insert("e");
+
+    OrderedSet<QString> united = set;
+    united.unite(other);
+    QVERIFY(united.toList() == (QList<QString>() << "c" << "a" << "b" << "d" << "e"));
+
+    OrderedSet<QString> intersected = united;
+    intersected.intersect(other);
+    QVERIFY(intersected.toList() == (QList<QString>() << "b" << "d" << "e"));
+
+    OrderedSet<QString> subtracted = united;
+    subtracted.subtract(other);
+    QVERIFY(subtracted == set.subtract(other));
+    QVERIFY(subtracted.toList() == (QList<QString>() << "c" << "a"));
+
+    QVERIFY(subtracted.remove("c"));
+    QVERIFY(!subtracted.remove("c"));
+    QVERIFY(subtracted != united);
+
+    QByteArray bytes;
+    {
+        QDataStream out(&bytes, QIODevice::WriteOnly);
+        out << united;
+    }
+    OrderedSet<QString> loaded;
+    QDataStream in(bytes);
+    in >> loaded;
+    QVERIFY(loaded == united);
+
+    // A key repeated in the stream keeps its first position
+    QByteArray repeated;
+    {
+        QDataStream out(&repeated, QIODevice::WriteOnly);
+        out << quint32(4) << QString("x") << QString("y") << QString("x") << QString("z");
+    }
+    QDataStream repeatedIn(repeated);
+    repeatedIn >> loaded;
+    QVERIFY(repeatedIn.status() == QDataStream::Ok);
+    QVERIFY(loaded.toList() == (QList<QString>() << "x" << "y" << "z"));
+}
+
+#ifdef Q_COMPILER_RANGE_FOR
+void TestOrderedMap::viewsTest()
+{
+    OrderedMap<QString, int> om;
+    om.insert(QString("b"),2);
+    om.insert(QString("a"),1);
+    om.insert(QString("c"),3);
+    om.insert(QString("b"),20);
+
+    QString keyAns[] = {QString("a"), QString("c"), QString("b")};
+    int valueAns[] = {1, 3, 20};
+
+    int i = 0;
+    for (const QString &key : om.keyView()) {
+        QVERIFY(key == keyAns[i++]);
+    }
+    QVERIFY(i == 3);
+
+    i = 0;
+    for (int value : om.valueView()) {
+        QVERIFY(value == valueAns[i++]);
+    }
+    QVERIFY(i == 3);
+
+    i = 0;
+    for (auto item : om.items()) {
+        QVERIFY(item.first == keyAns[i]);
+        QVERIFY(item.second == valueAns[i]);
+        i++;
+    }
+    QVERIFY(i == 3);
+
+    OrderedMap<QString, int> empty;
+    QVERIFY(empty.keyView().begin() == empty.keyView().end());
+    QVERIFY(empty.items().begin() == empty.items().end());
+}
+#endif
+
 void TestOrderedMap::insertTest()
 {
     OrderedMap<int, QString> om;
@@ -485,6 +1708,74 @@ void TestOrderedMap::insertTest()
     QVERIFY(it2.value() == QString::number(2));
 }
 
+void TestOrderedMap::bulkInsertTest()
+{
+    OrderedMap<int, int> om;
+    om.insert(1, 1);
+    om.insert(2, 2);
+    om.insert(3, 3);
+
+    // Existing and repeated keys end up where a loop of insert() puts them
+    QVector<std::pair<int, int> > pairs;
+    pairs.append(std::make_pair(4, 4));
+    pairs.append(std::make_pair(1, 10));
+    pairs.append(std::make_pair(5, 5));
+    pairs.append(std::make_pair(4, 40));
+
+    OrderedMap<int, int> expected = om;
+    for (int i = 0; i < pairs.size(); ++i) {
+        expected.insert(pairs.at(i).first, pairs.at(i).second);
+    }
+    om.insert(pairs.constBegin(), pairs.constEnd());
+
+    QVERIFY(om == expected);
+    QVERIFY(om.keys() == (QList<int>() << 2 << 3 << 1 << 5 << 4));
+    QVERIFY(om.value(4) == 40);
+
+    // Large enough to grow the index
+    QVector<std::pair<int, int> > many;
+    for (int i = 0; i < 1000; ++i) {
+        many.append(std::make_pair(i % 700, i));
+    }
+    expected = om;
+    for (int i = 0; i < many.size(); ++i) {
+        expected.insert(many.at(i).first, many.at(i).second);
+    }
+    om.insert(many.constBegin(), many.constEnd());
+    QVERIFY(om == expected);
+    QVERIFY(om.size() == 700);
+
+    OrderedMap<int, int> other;
+    other.insert(3, 30);
+    other.insert(1000, 1000);
+
+    OrderedMap<int, int> merged = om;
+    merged.insert(other);
+    QVERIFY(merged.size() == 701);
+    QVERIFY(merged.keyAt(699) == 3);
+    QVERIFY(merged.value(3) == 30);
+    QVERIFY(merged.keyAt(700) == 1000);
+
+    OrderedMap<int, int> united = om;
+    united.unite(other);
+    QVERIFY(united.size() == 701);
+    QVERIFY(united.indexOf(3) == om.indexOf(3));
+    QVERIFY(united.value(3) == om.value(3));
+    QVERIFY(united.keyAt(700) == 1000);
+
+    OrderedMap<int, int> empty;
+    empty.unite(other);
+    QVERIFY(empty == other);
+
+    // insert(key, value) must still be chosen when both arguments have one type
+    OrderedMap<QString, QString> strings;
+    strings.insert("a", "b");
+    QVERIFY(strings.value("a") == QString("b"));
+    OrderedMap<qint64, qint64> wide;
+    wide.insert(1, 2);
+    QVERIFY(wide.value(1) == 2);
+}
+
 void TestOrderedMap::beginTest()
 {
     OrderedMap<QString, QString> om;
@@ -529,6 +1820,39 @@ void TestOrderedMap::findTest()
     QVERIFY(it == om.end());
 }
 
+void TestOrderedMap::findManyTest()
+{
+    OrderedMap<int, QString> om;
+    QList<int> keys;
+    for (int i = 0; i < 100; ++i) {
+        om.insert(i, QString::number(i));
+        // Every other key is missing, and the batches are not a multiple of their size
+        keys.append(i * 2);
+    }
+    keys.append(7);
+
+    QList<OrderedMap<int, QString>::const_iterator> found = om.findMany(keys);
+    QList<QString> values = om.valuesFor(keys);
+
+    QVERIFY(found.size() == keys.size());
+    QVERIFY(values.size() == keys.size());
+    for (int i = 0; i < keys.size(); ++i) {
+        if (keys.at(i) < 100) {
+            QVERIFY(found.at(i).key() == keys.at(i));
+            QVERIFY(found.at(i).value() == QString::number(keys.at(i)));
+            QVERIFY(values.at(i) == QString::number(keys.at(i)));
+        } else {
+            QVERIFY(found.at(i) == om.end());
+            QVERIFY(values.at(i).isEmpty());
+        }
+    }
+
+    OrderedMap<int, QString> empty;
+    QVERIFY(empty.findMany(keys).at(0) == empty.end());
+    QVERIFY(empty.valuesFor(keys).size() == keys.size());
+    QVERIFY(om.findMany(QList<int>()).isEmpty());
+}
+
 void TestOrderedMap::eraseTest()
 {
     OrderedMap<int, int> om;
@@ -548,6 +1872,102 @@ void TestOrderedMap::eraseTest()
     QVERIFY(it == om.end());
 }
 
+static bool isOdd(const int &key, const QString &)
+{
+    return key % 2;
+}
+
+void TestOrderedMap::rangeEraseTest()
+{
+    OrderedMap<int, QString> om;
+    for (int i = 0; i < 100; ++i) {
+        om.insert(i, QString::number(i));
+    }
+
+    OrderedMap<int, QString>::iterator it = om.erase(om.begin() + 10, om.begin() + 20);
+    QVERIFY(it.key() == 20);
+    QVERIFY(om.size() == 90);
+    QVERIFY(!om.contains(10));
+    QVERIFY(!om.contains(19));
+    QVERIFY(om.keyAt(10) == 20);
+
+    QVERIFY(om.erase(om.begin(), om.begin()) == om.begin());
+    QVERIFY(om.size() == 90);
+
+    QVERIFY(om.truncateFront(5) == 5);
+    QVERIFY(om.begin().key() == 5);
+    QVERIFY(!om.contains(4));
+    QVERIFY(om.indexOf(20) == 5);
+
+    QVERIFY(om.removeIf(isOdd) == 43);
+    QVERIFY(om.size() == 42);
+    QList<int> keys = om.keys();
+    for (int i = 0; i < keys.size(); ++i) {
+        QVERIFY(keys.at(i) % 2 == 0);
+        QVERIFY(om.value(keys.at(i)) == QString::number(keys.at(i)));
+    }
+    QVERIFY(!om.contains(21));
+
+    // Removing most of the map rebuilds the index instead
+    QVERIFY(om.truncateFront(39) == 39);
+    QVERIFY(om.keys() == (QList<int>() << 94 << 96 << 98));
+    QVERIFY(om.value(96) == QString("96"));
+    QVERIFY(!om.contains(92));
+
+    QVERIFY(om.truncateFront(10) == 3);
+    QVERIFY(om.isEmpty());
+    QVERIFY(om.begin() == om.end());
+
+    om.insert(1, QString("1"));
+    QVERIFY(om.keys() == QList<int>() << 1);
+}
+
+void TestOrderedMap::extractSpliceTest()
+{
+    // Long enough not to fit in a small string buffer, so moves keep the data
+    const QString longValue("a value that is stored out of line");
+
+    OrderedMap<int, QString> hot;
+    OrderedMap<int, QString> cold;
+    hot.insert(1, longValue);
+    hot.insert(2, QString("2"));
+    hot.insert(3, QString("3"));
+    cold.insert(3, QString("old"));
+    cold.insert(4, QString("4"));
+
+    const QChar *data = hot.find(1).value().constData();
+
+    OrderedMap<int, QString>::node_type node = hot.extract(1);
+    QVERIFY(!node.isEmpty());
+    QVERIFY(node.key() == 1);
+    QVERIFY(node.value().constData() == data);
+    QVERIFY(!hot.contains(1));
+    QVERIFY(hot.size() == 2);
+
+    OrderedMap<int, QString>::iterator it = cold.insert(node);
+    QVERIFY(node.isEmpty());
+    QVERIFY(it.key() == 1);
+    QVERIFY(it.value().constData() == data);
+    QVERIFY(cold.keys() == (QList<int>() << 3 << 4 << 1));
+
+    QVERIFY(hot.extract(1).isEmpty());
+    QVERIFY(cold.insert(node) == cold.end());
+
+    // Existing keys are overwritten and moved to the end, like insert()
+    it = cold.splice(hot, hot.find(3));
+    QVERIFY(it.key() == 3);
+    QVERIFY(it.value() == QString("3"));
+    QVERIFY(cold.keys() == (QList<int>() << 4 << 1 << 3));
+    QVERIFY(hot.keys() == QList<int>() << 2);
+
+    QVERIFY(cold.splice(hot, hot.end()) == cold.end());
+
+    it = hot.splice(cold, cold.find(1));
+    QVERIFY(it.value().constData() == data);
+    QVERIFY(hot.keys() == (QList<int>() << 2 << 1));
+    QVERIFY(cold.indexOf(1) == -1);
+}
+
 void TestOrderedMap::iterationOrderTest()
 {
     OrderedMap<int, int> om;
@@ -1,11 +1,81 @@
+#include <QByteArray>
+#include <QDataStream>
 #include <QMap>
 #include <QHash>
 #include <QLinkedList>
+#include <QPair>
 #include <QString>
-#include <QTime>
+#include <QElapsedTimer>
+#include <QVector>
 #include <QDebug>
 
+#if (QT_VERSION >= 0x050a00)
+#include <QRandomGenerator>
+#endif
+
 #include "orderedmap.h"
+#include "orderedmapconcurrent.h"
+#include "orderedmapdiff.h"
+#include "orderedmaphash.h"
+#include "orderedstringmap.h"
+#include "persistentorderedmap.h"
+
+#include <algorithm>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Stands in for an expensive per-value transform
+static int digitScore(const int &key, const QString &value)
+{
+    uint score = uint(key);
+    for (int round = 0; round < 64; ++round) {
+        for (int i = 0; i < value.size(); ++i) {
+            score = score * 31 + value.at(i).unicode();
+        }
+    }
+    return int(score % 1000);
+}
+
+static void addScore(qint64 &total, const int &key, const QString &value)
+{
+    total += digitScore(key, value);
+}
+
+static void addTotal(qint64 &total, const qint64 &chunkTotal)
+{
+    total += chunkTotal;
+}
+
+static bool byScore(const int &, const int &score1, const int &, const int &score2)
+{
+    return score1 < score2;
+}
+
+// qrand() is deprecated in Qt 5.15 and gone in Qt 6
+static int randomIndex(int count)
+{
+#if (QT_VERSION >= 0x050a00)
+    return QRandomGenerator::global()->bounded(count);
+#else
+    return qrand() % count;
+#endif
+}
+
+// Bytes currently allocated from the heap, or 0 where that is not available
+static qint64 heapInUse()
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+    struct mallinfo2 info = mallinfo2();
+    return qint64(info.uordblks + info.hblkhd);
+#elif defined(__GLIBC__)
+    struct mallinfo info = mallinfo();
+    return qint64(info.uordblks) + info.hblkhd;
+#else
+    return 0;
+#endif
+}
 
 int main(int argc, char **argv)
 {
@@ -30,7 +100,7 @@ int main(int argc, char **argv)
 
     OrderedMap<int, QString> om;
 
-    QTime timer;
+    QElapsedTimer timer;
 
     qDebug() << "Timing insertion of" << itemCount << "items...\n";
 
@@ -90,24 +160,505 @@ int main(int argc, char **argv)
     qDebug() << "Ordered map :" << timer.elapsed() << "msecs";
     qDebug() << "\n";
 
+    // Separately built copies, so that no comparison can take a shortcut on shared data
+    qDebug() << "Timing comparison of two equal copies of" << itemCount << "items...\n";
+
+    {
+        QMap<int, QString> map2;
+        QHash<int, QString> hash2;
+        OrderedMap<int, QString> om2;
+        for (int i=0; i<itemCount; i++) {
+            map2.insert(i, QString::number(i));
+            hash2.insert(i, QString::number(i));
+            om2.insert(i, QString::number(i));
+        }
+
+        timer.start();
+        bool equal = map == map2;
+        qDebug() << "Map :" << timer.elapsed() << "msecs" << equal;
+
+        timer.start();
+        equal = hash == hash2;
+        qDebug() << "Hash :" << timer.elapsed() << "msecs" << equal;
+
+        timer.start();
+        equal = om == om2;
+        qDebug() << "Ordered map :" << timer.elapsed() << "msecs" << equal;
+
+        om2.insert(itemCount - 1, QString());
+        timer.start();
+        equal = om == om2;
+        qDebug() << "Ordered map, last value differs :" << timer.elapsed() << "msecs" << equal;
+
+        om2 = om;
+        timer.start();
+        equal = om == om2;
+        qDebug() << "Ordered map, shared copy :" << timer.elapsed() << "msecs" << equal;
+    }
+    qDebug() << "\n";
+
+    qDebug() << "Timing bulk insertion of" << itemCount << "items...\n";
+
+    QVector<std::pair<int, QString> > pairs;
+    pairs.reserve(itemCount);
+    for (int i = 0; i < itemCount; i++) {
+        pairs.append(std::make_pair(i, QString::number(i)));
+    }
+
+    timer.start();
+    {
+        OrderedMap<int, QString> built;
+        for (int i = 0; i < pairs.size(); i++) {
+            built.insert(pairs.at(i).first, pairs.at(i).second);
+        }
+        dummy = built.size();
+    }
+    qDebug() << "Ordered map insert loop :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        OrderedMap<int, QString> built;
+        built.insert(pairs.constBegin(), pairs.constEnd());
+        dummy = built.size();
+    }
+    qDebug() << "Ordered map range insert :" << timer.elapsed() << "msecs";
+
+    // Half of the keys overlap, so both merges also overwrite
+    OrderedMap<int, QString> other;
+    for (int i = itemCount / 2; i < itemCount + itemCount / 2; i++) {
+        other.insert(i, QString::number(i));
+    }
+
+    timer.start();
+    {
+        OrderedMap<int, QString> merged = om;
+        OrderedMap<int, QString>::const_iterator it = other.begin();
+        for (; it != other.end(); ++it) {
+            merged.insert(it.key(), it.value());
+        }
+        dummy = merged.size();
+    }
+    qDebug() << "Ordered map merge loop :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        OrderedMap<int, QString> merged = om;
+        merged.insert(other);
+        dummy = merged.size();
+    }
+    qDebug() << "Ordered map merge :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
+    qDebug() << "Timing save and load of" << itemCount << "items...\n";
+
+    QByteArray bytes;
+    timer.start();
+    {
+        QDataStream out(&bytes, QIODevice::WriteOnly);
+        out << om;
+    }
+    qDebug() << "Ordered map save :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        OrderedMap<int, QString> loaded;
+        QDataStream in(bytes);
+        in >> loaded;
+        dummy = loaded.size();
+    }
+    qDebug() << "Ordered map load :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        // What loading looked like without operator>>: insert() per entry
+        OrderedMap<int, QString> loaded;
+        QDataStream in(bytes);
+        quint32 n;
+        in >> n;
+        for (quint32 i = 0; i < n; ++i) {
+            int key;
+            QString value;
+            in >> key >> value;
+            loaded.insert(key, value);
+        }
+        dummy = loaded.size();
+    }
+    qDebug() << "Ordered map insert loop :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
+    // Random keys, so lookups miss the cache once the map is larger than it
+    const int batchSize = 256;
+    const int batchCount = 2000;
+    QList<int> lookupKeys;
+    lookupKeys.reserve(batchSize * batchCount);
+    for (int i = 0; i < batchSize * batchCount; ++i) {
+        lookupKeys.append(randomIndex(itemCount));
+    }
+
+    qDebug() << "Timing" << batchCount << "lookups of" << batchSize << "random keys in"
+             << itemCount << "items...\n";
+
+    dummy = 0;
+    timer.start();
+    for (int i = 0; i < lookupKeys.size(); ++i) {
+        dummy += om.value(lookupKeys.at(i)).size();
+    }
+    qDebug() << "Ordered map value() :" << timer.elapsed() << "msecs";
+
+    dummy = 0;
+    timer.start();
+    for (int i = 0; i < lookupKeys.size(); i += batchSize) {
+        QList<QString> values = om.valuesFor(lookupKeys.mid(i, batchSize));
+        for (int j = 0; j < values.size(); ++j) {
+            dummy += values.at(j).size();
+        }
+    }
+    qDebug() << "Ordered map valuesFor() :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
+    qDebug() << "Timing a transform of every value of" << itemCount << "items...\n";
+
+    timer.start();
+    {
+        OrderedMap<int, int> scores;
+        scores.reserve(om.size());
+        for (OrderedMap<int, QString>::const_iterator it = om.begin(); it != om.end(); ++it) {
+            scores.insert(it.key(), digitScore(it.key(), it.value()));
+        }
+        dummy = scores.size();
+    }
+    qDebug() << "Ordered map loop :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    dummy = OrderedMapConcurrent::mapValues<int>(om, digitScore).size();
+    qDebug() << "Ordered map mapValues() :" << timer.elapsed() << "msecs";
+
+    qint64 total = 0;
+    timer.start();
+    for (OrderedMap<int, QString>::const_iterator it = om.begin(); it != om.end(); ++it) {
+        total += digitScore(it.key(), it.value());
+    }
+    qDebug() << "Ordered map sum loop :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    if (OrderedMapConcurrent::reduce(om, qint64(0), addScore, addTotal) != total) {
+        qWarning() << "reduce() disagrees with the loop";
+    }
+    qDebug() << "Ordered map reduce() :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
+    qDebug() << "Timing re-ranking of" << itemCount << "items by score...\n";
+
+    {
+        OrderedMap<int, int> scores;
+        for (int i = 0; i < itemCount; ++i) {
+            scores.insert(i, int((uint(i) * 2654435761u) % 1000000));
+        }
+        OrderedMap<int, int> sorted = scores;
+
+        // What re-ranking took before sort(): sort the entries aside, then rebuild
+        timer.start();
+        {
+            QVector<QPair<int, int> > ranked;
+            ranked.reserve(scores.size());
+            for (OrderedMap<int, int>::const_iterator it = scores.begin(); it != scores.end(); ++it) {
+                ranked.append(qMakePair(it.value(), it.key()));
+            }
+            std::stable_sort(ranked.begin(), ranked.end());
+            OrderedMap<int, int> rebuilt;
+            for (int i = 0; i < ranked.size(); ++i) {
+                rebuilt.insert(ranked.at(i).second, ranked.at(i).first);
+            }
+            sorted = rebuilt;
+        }
+        qDebug() << "Ordered map clear and re-insert :" << timer.elapsed() << "msecs";
+
+        OrderedMap<int, int> inPlace = scores;
+        timer.start();
+        inPlace.sortByValue();
+        qDebug() << "Ordered map sortByValue() :" << timer.elapsed() << "msecs";
+
+        OrderedMap<int, int> parallel = scores;
+        timer.start();
+        OrderedMapConcurrent::sort(parallel, byScore);
+        qDebug() << "Ordered map parallel sort() :" << timer.elapsed() << "msecs";
+        if (inPlace != sorted || parallel != sorted) {
+            qDebug() << "The sorts disagree";
+        }
+    }
+    qDebug() << "\n";
+
+    qDebug() << "Timing eviction of the oldest" << itemCount / 2 << "of" << itemCount << "items...\n";
+
+    timer.start();
+    {
+        OrderedMap<int, QString> evicted = om;
+        OrderedMap<int, QString>::iterator it = evicted.begin();
+        for (int i = 0; i < itemCount / 2; i++) {
+            it = evicted.erase(it);
+        }
+        dummy = evicted.size();
+    }
+    qDebug() << "Ordered map erase loop :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        OrderedMap<int, QString> evicted = om;
+        evicted.truncateFront(itemCount / 2);
+        dummy = evicted.size();
+    }
+    qDebug() << "Ordered map truncateFront() :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
+    // Small maps scan their entries; reserving past the scan limit forces the
+    // index they would otherwise have
+    const int smallSize = 8;
+    const int smallCount = qMax(1, itemCount / smallSize);
+    qDebug() << "Timing" << smallCount << "maps of" << smallSize << "items...\n";
+
+    for (int indexed = 0; indexed < 2; ++indexed) {
+        const char *mode = indexed ? "with index" : "linear scan";
+        qint64 heapBefore = heapInUse();
+        timer.start();
+        QVector<OrderedMap<int, int> > smallMaps(smallCount);
+        for (int m = 0; m < smallCount; ++m) {
+            OrderedMap<int, int> &small = smallMaps[m];
+            small.reserve(indexed ? smallSize + 1 : smallSize);
+            for (int i = 0; i < smallSize; ++i) {
+                small.insert(m + i, i);
+            }
+        }
+        qDebug() << "Ordered map" << mode << "insert :" << timer.elapsed() << "msecs,"
+                 << (heapInUse() - heapBefore) / smallCount << "heap bytes per map";
+
+        // Half of the lookups miss
+        dummy = 0;
+        timer.start();
+        for (int m = 0; m < smallCount; ++m) {
+            const OrderedMap<int, int> &small = smallMaps.at(m);
+            for (int i = 0; i < 2 * smallSize; ++i) {
+                dummy += small.value(m + i, 0);
+            }
+        }
+        qDebug() << "Ordered map" << mode << "lookup :" << timer.elapsed() << "msecs";
+    }
+    qDebug() << "\n";
+
+    // Keys are built beforehand, so that only the copies the maps keep count
+    qDebug() << "Timing" << itemCount << "string keys...\n";
+
+    {
+        QVector<QString> keys;
+        keys.reserve(itemCount);
+        for (int i = 0; i < itemCount; ++i) {
+            keys.append(QString("item-%1").arg(i));
+        }
+
+        qint64 heapBefore = heapInUse();
+        timer.start();
+        OrderedMap<QString, int> strings;
+        for (int i = 0; i < itemCount; ++i) {
+            strings.insert(QString(keys.at(i).constData(), keys.at(i).size()), i);
+        }
+        qDebug() << "Ordered map insert :" << timer.elapsed() << "msecs,"
+                 << (heapInUse() - heapBefore) / qMax(1, itemCount) << "heap bytes per key";
+
+        dummy = 0;
+        timer.start();
+        for (int i = 0; i < itemCount; ++i) {
+            dummy += strings.value(keys.at(i));
+        }
+        qDebug() << "Ordered map lookup :" << timer.elapsed() << "msecs";
+
+        heapBefore = heapInUse();
+        timer.start();
+        OrderedStringMap<int> arenaStrings;
+        for (int i = 0; i < itemCount; ++i) {
+            arenaStrings.insert(keys.at(i), i);
+        }
+        qDebug() << "Ordered string map insert :" << timer.elapsed() << "msecs,"
+                 << (heapInUse() - heapBefore) / qMax(1, itemCount) << "heap bytes per key";
+
+        dummy = 0;
+        timer.start();
+        for (int i = 0; i < itemCount; ++i) {
+            dummy += arenaStrings.value(keys.at(i));
+        }
+        qDebug() << "Ordered string map lookup :" << timer.elapsed() << "msecs";
+    }
+    qDebug() << "\n";
+
+    qDebug() << "Timing hashes of" << itemCount << "keys...\n";
+
+    {
+        /* A thousand keys of each size, reused, so they stay in the cache. The
+         * hashes go to a volatile, as inlined hashing nobody reads is dropped.
+         */
+        volatile uint hashes = 0;
+        const int sizes[] = { 8, 32, 256 };
+        for (int s = 0; s < 3; ++s) {
+            QVector<QByteArray> sized;
+            for (int i = 0; i < 1000; ++i) {
+                QByteArray key = QByteArray::number(i);
+                sized.append(key + QByteArray(sizes[s] - key.size(), 'k'));
+            }
+
+            timer.start();
+            for (int i = 0; i < itemCount; ++i) {
+                hashes = qHash(sized.at(i % 1000));
+            }
+            qDebug() << "qHash," << sizes[s] << "bytes :" << timer.elapsed() << "msecs";
+
+            timer.start();
+            for (int i = 0; i < itemCount; ++i) {
+                const QByteArray &key = sized.at(i % 1000);
+                hashes = oMHashBytes(key.constData(), key.size());
+            }
+            qDebug() << "oMHashBytes," << sizes[s] << "bytes :" << timer.elapsed() << "msecs";
+        }
+
+        QVector<QByteArray> keys;
+        keys.reserve(itemCount);
+        for (int i = 0; i < itemCount; ++i) {
+            keys.append(QByteArray("/api/v2/items/") + QByteArray::number(i) + QByteArray("/details"));
+        }
+
+        OrderedMap<QByteArray, int> defaultHash;
+        OrderedMap<QByteArray, int, OrderedMapFastHash> fastHash;
+        for (int i = 0; i < itemCount; ++i) {
+            defaultHash.insert(keys.at(i), i);
+            fastHash.insert(keys.at(i), i);
+        }
+
+        dummy = 0;
+        timer.start();
+        for (int i = 0; i < itemCount; ++i) {
+            dummy += defaultHash.value(keys.at(i));
+        }
+        qDebug() << "Ordered map lookup, qHash :" << timer.elapsed() << "msecs";
+
+        timer.start();
+        for (int i = 0; i < itemCount; ++i) {
+            dummy += fastHash.value(keys.at(i));
+        }
+        qDebug() << "Ordered map lookup, OrderedMapFastHash :" << timer.elapsed() << "msecs";
+    }
+    qDebug() << "\n";
+
+    // One entry in a hundred changes value, half as many move to the end
+    qDebug() << "Timing a diff of" << itemCount << "items, 1% of them changed...\n";
+
+    {
+        OrderedMap<int, int> older;
+        for (int i = 0; i < itemCount; ++i) {
+            older.insert(i, i);
+        }
+        OrderedMap<int, int> newer = older;
+        for (int i = 0; i < itemCount; i += 100) {
+            newer[i] = -i;
+        }
+        for (int i = 50; i < itemCount; i += 200) {
+            newer.insert(i, i);
+        }
+
+        timer.start();
+        OrderedMapDiff<int, int> changes = diff(older, newer);
+        qDebug() << "Ordered map diff() :" << timer.elapsed() << "msecs";
+
+        QByteArray full;
+        QByteArray delta;
+        {
+            QDataStream out(&full, QIODevice::WriteOnly);
+            out << newer;
+        }
+        {
+            QDataStream out(&delta, QIODevice::WriteOnly);
+            out << changes;
+        }
+        qDebug() << "Streamed map :" << full.size() << "bytes, streamed diff :" << delta.size() << "bytes";
+
+        timer.start();
+        applyDiff(older, changes);
+        qDebug() << "Ordered map applyDiff() :" << timer.elapsed() << "msecs";
+        if (older != newer) {
+            qDebug() << "applyDiff() did not reproduce the newer map";
+        }
+    }
+    qDebug() << "\n";
+
+    // Every version is kept, as an undo history would keep them
+    const int versionSize = qMax(1, itemCount / 10);
+    const int versionCount = 50;
+    qDebug() << "Timing" << versionCount << "versions of" << versionSize << "items, one insert apart...\n";
+
+    {
+        OrderedMap<int, int> base;
+        for (int i = 0; i < versionSize; ++i) {
+            base.insert(i, i);
+        }
+
+        qint64 heapBefore = heapInUse();
+        timer.start();
+        QVector<OrderedMap<int, int> > copies;
+        copies.append(base);
+        for (int v = 1; v < versionCount; ++v) {
+            OrderedMap<int, int> next = copies.last();
+            next.insert(versionSize + v, v);
+            copies.append(next);
+        }
+        qDebug() << "Ordered map copy and insert :" << timer.elapsed() << "msecs,"
+                 << (heapInUse() - heapBefore) / versionCount << "heap bytes per version";
+        copies.clear();
+
+        const PersistentOrderedMap<int, int> persistentBase(base);
+        heapBefore = heapInUse();
+        timer.start();
+        QVector<PersistentOrderedMap<int, int> > versions;
+        versions.append(persistentBase);
+        for (int v = 1; v < versionCount; ++v) {
+            versions.append(versions.last().insert(versionSize + v, v));
+        }
+        qDebug() << "Persistent ordered map insert :" << timer.elapsed() << "msecs,"
+                 << (heapInUse() - heapBefore) / versionCount << "heap bytes per version";
+    }
+
+    timer.start();
+    {
+        OrderedMap<int, int> om;
+        for (int i = 0; i < itemCount; ++i) {
+            om.insert(i, i);
+        }
+    }
+    qDebug() << "Ordered map insert loop of" << itemCount << "items :" << timer.elapsed() << "msecs";
+
+    timer.start();
+    {
+        PersistentOrderedMap<int, int> pm;
+        for (int i = 0; i < itemCount; ++i) {
+            pm = pm.insert(i, i);
+        }
+    }
+    qDebug() << "Persistent ordered map insert loop of" << itemCount << "items :" << timer.elapsed() << "msecs";
+    qDebug() << "\n";
+
     qDebug() << "Timing removal of random item from" << itemCount << "items...\n";
 
-    int rand = qrand() % itemCount;
+    int rand = randomIndex(itemCount);
     timer.start();
     map.remove(rand);
     qDebug() << "Map :" << timer.elapsed() << "msecs";
 
-    rand = qrand() % itemCount;
+    rand = randomIndex(itemCount);
     timer.start();
     hash.remove(rand);
     qDebug() << "Hash :" << timer.elapsed() << "msecs";
 
-    rand = qrand() % itemCount;
+    rand = randomIndex(itemCount);
     timer.start();
     linkList.removeOne(QString::number(rand));
     qDebug() << "Link list :" << timer.elapsed() << "msecs";
 
-    rand = qrand() % itemCount;
+    rand = randomIndex(itemCount);
     timer.start();
     om.remove(rand);
     qDebug() << "Ordered map :" << timer.elapsed() << "msecs";
@@ -1,9 +1,16 @@
 QT -= gui
 
 greaterThan(QT_MAJOR_VERSION, 4) {
+QT += concurrent
 CONFIG += c++11
 }
 
+# Qt 6 needs C++17, and QLinkedList, compared against, moved to Core5Compat
+greaterThan(QT_MAJOR_VERSION, 5) {
+QT += core5compat
+CONFIG += c++17
+}
+
 SOURCES = \
     main.cpp
 
@@ -2,4 +2,5 @@ TEMPLATE = subdirs
 
 SUBDIRS += functional \
            performance \
+           tracereplay \
 
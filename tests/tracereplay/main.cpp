@@ -0,0 +1,315 @@
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
+#include <QString>
+#include <QVector>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+#include "orderedmap.h"
+#include "lrucache.h"
+
+/* Replays a key-access trace against a cache and reports throughput,
+ * per-operation latency percentiles and the hit ratio.
+ *
+ * Every access is a lookup; on a miss the key is inserted, evicting the
+ * oldest entry once the cache is at capacity. The "lru" backend uses
+ * LruCache (hits refresh the entry), the "map" backend drives an OrderedMap
+ * directly as a FIFO cache (hits do not change the order).
+ */
+
+typedef quint64 TraceKey;
+
+static void printUsage(const char *prog)
+{
+    qDebug() << "\nUsage:\n\t" << prog << "[--backend lru|map] <capacity> <trace>\n"
+             << "\nTrace:\n"
+             << "\tfile <path>                 one key per line, '#' starts a comment\n"
+             << "\tzipf <ops> <keys> [skew]    Zipfian popularity, skew defaults to 0.99\n"
+             << "\tscan <ops> <keys>           sequential scan 0..keys-1, repeated\n"
+             << "\tloop <ops> <keys>           like scan, in a random but fixed key order\n";
+}
+
+// xorshift64*, so generated traces are reproducible across platforms
+class TraceRandom
+{
+public:
+    explicit TraceRandom(quint64 seed) : state(seed ? seed : Q_UINT64_C(0x9E3779B97F4A7C15)) {}
+
+    quint64 next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * Q_UINT64_C(2685821657736338717);
+    }
+
+    // Uniform in [0, 1)
+    double nextDouble()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+private:
+    quint64 state;
+};
+
+static bool loadTraceFile(const QString &path, QVector<TraceKey> &trace)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning() << "\nError! Cannot open trace file" << path;
+        return false;
+    }
+
+    /* Every token is interned to a dense id, outside the timed replay, so
+     * that a word and a number can never stand for the same key.
+     */
+    QHash<QByteArray, TraceKey> interned;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        int comment = line.indexOf('#');
+        if (comment >= 0) {
+            line.truncate(comment);
+        }
+        line = line.trimmed();
+        if (line.isEmpty()) {
+            continue;
+        }
+
+        int space = line.indexOf(' ');
+        QByteArray token = space < 0 ? line : line.left(space);
+
+        QHash<QByteArray, TraceKey>::const_iterator it = interned.constFind(token);
+        if (it == interned.constEnd()) {
+            it = interned.insert(token, interned.size());
+        }
+        trace.append(it.value());
+    }
+    return true;
+}
+
+static void generateZipf(int ops, int keys, double skew, QVector<TraceKey> &trace)
+{
+    // Inverse CDF over the key ranks; rank 0 is the most popular key
+    QVector<double> cdf(keys);
+    double sum = 0.0;
+    for (int i = 0; i < keys; ++i) {
+        sum += 1.0 / std::pow(double(i + 1), skew);
+        cdf[i] = sum;
+    }
+
+    // Scatter ranks over the key space so popularity is not tied to key order
+    QVector<TraceKey> rankToKey(keys);
+    for (int i = 0; i < keys; ++i) {
+        rankToKey[i] = i;
+    }
+    TraceRandom random(42);
+    for (int i = keys - 1; i > 0; --i) {
+        std::swap(rankToKey[i], rankToKey[int(random.next() % (i + 1))]);
+    }
+
+    trace.reserve(ops);
+    for (int i = 0; i < ops; ++i) {
+        double u = random.nextDouble() * sum;
+        int rank = int(std::lower_bound(cdf.constBegin(), cdf.constEnd(), u) - cdf.constBegin());
+        trace.append(rankToKey[qMin(rank, keys - 1)]);
+    }
+}
+
+static void generateScan(int ops, int keys, QVector<TraceKey> &trace)
+{
+    trace.reserve(ops);
+    for (int i = 0; i < ops; ++i) {
+        trace.append(TraceKey(i % keys));
+    }
+}
+
+static void generateLoop(int ops, int keys, QVector<TraceKey> &trace)
+{
+    QVector<TraceKey> order(keys);
+    for (int i = 0; i < keys; ++i) {
+        order[i] = i;
+    }
+    TraceRandom random(7);
+    for (int i = keys - 1; i > 0; --i) {
+        std::swap(order[i], order[int(random.next() % (i + 1))]);
+    }
+
+    trace.reserve(ops);
+    for (int i = 0; i < ops; ++i) {
+        trace.append(order[i % keys]);
+    }
+}
+
+static qint64 percentile(QVector<qint64> &samples, double p)
+{
+    if (samples.isEmpty()) {
+        return 0;
+    }
+    int index = qMin(int(samples.size()) - 1, int(p * samples.size()));
+    std::nth_element(samples.begin(), samples.begin() + index, samples.end());
+    return samples.at(index);
+}
+
+class ReplayResult
+{
+public:
+    ReplayResult() : hits(0), misses(0), totalNsecs(0) {}
+
+    qint64 hits;
+    qint64 misses;
+    qint64 totalNsecs;
+    QVector<qint64> hitNsecs;
+    QVector<qint64> missNsecs;
+};
+
+static void replayLru(const QVector<TraceKey> &trace, int capacity, ReplayResult &result)
+{
+    LruCache<TraceKey, TraceKey> cache(capacity);
+    QElapsedTimer total, op;
+    qint64 dummy = 0;
+
+    total.start();
+    for (int i = 0; i < trace.size(); ++i) {
+        const TraceKey key = trace.at(i);
+        op.start();
+        TraceKey value;
+        if (cache.lookup(key, value)) {
+            dummy += value;
+            result.hitNsecs.append(op.nsecsElapsed());
+        } else {
+            cache.insert(key, key);
+            result.missNsecs.append(op.nsecsElapsed());
+        }
+    }
+    result.totalNsecs = total.nsecsElapsed();
+    result.hits = result.hitNsecs.size();
+    result.misses = result.missNsecs.size();
+    Q_UNUSED(dummy);
+}
+
+static void replayOrderedMap(const QVector<TraceKey> &trace, int capacity, ReplayResult &result)
+{
+    OrderedMap<TraceKey, TraceKey> map;
+    const OrderedMap<TraceKey, TraceKey> &constMap = map;
+    QElapsedTimer total, op;
+    qint64 dummy = 0;
+
+    total.start();
+    for (int i = 0; i < trace.size(); ++i) {
+        const TraceKey key = trace.at(i);
+        op.start();
+        OrderedMap<TraceKey, TraceKey>::const_iterator it = constMap.find(key);
+        if (it != constMap.end()) {
+            dummy += it.value();
+            result.hitNsecs.append(op.nsecsElapsed());
+        } else {
+            map.insert(key, key);
+            if (map.size() > capacity) {
+                map.erase(map.begin());
+            }
+            result.missNsecs.append(op.nsecsElapsed());
+        }
+    }
+    result.totalNsecs = total.nsecsElapsed();
+    result.hits = result.hitNsecs.size();
+    result.misses = result.missNsecs.size();
+    Q_UNUSED(dummy);
+}
+
+int main(int argc, char **argv)
+{
+    QString backend = "lru";
+    int arg = 1;
+
+    if (argc > arg + 1 && QString(argv[arg]) == "--backend") {
+        backend = argv[arg + 1];
+        arg += 2;
+    }
+
+    if (argc < arg + 3 || (backend != "lru" && backend != "map")) {
+        printUsage(*argv);
+        return 1;
+    }
+
+    bool ok = false;
+    int capacity = QString(argv[arg++]).toInt(&ok);
+    if (!ok || capacity <= 0) {
+        qWarning() << "\nError! Enter a valid capacity.";
+        printUsage(*argv);
+        return 1;
+    }
+
+    QString kind = argv[arg++];
+    QVector<TraceKey> trace;
+
+    if (kind == "file") {
+        if (!loadTraceFile(argv[arg], trace)) {
+            return 1;
+        }
+    } else if (kind == "zipf" || kind == "scan" || kind == "loop") {
+        bool opsOk = false, keysOk = false;
+        int ops = QString(argv[arg++]).toInt(&opsOk);
+        int keys = arg < argc ? QString(argv[arg++]).toInt(&keysOk) : 0;
+        if (!opsOk || !keysOk || ops <= 0 || keys <= 0) {
+            qWarning() << "\nError! Enter a valid number of operations and keys.";
+            printUsage(*argv);
+            return 1;
+        }
+
+        if (kind == "zipf") {
+            double skew = 0.99;
+            if (arg < argc) {
+                skew = QString(argv[arg]).toDouble(&ok);
+                if (!ok || skew <= 0.0) {
+                    qWarning() << "\nError! Enter a valid skew.";
+                    return 1;
+                }
+            }
+            generateZipf(ops, keys, skew, trace);
+        } else if (kind == "scan") {
+            generateScan(ops, keys, trace);
+        } else {
+            generateLoop(ops, keys, trace);
+        }
+    } else {
+        printUsage(*argv);
+        return 1;
+    }
+
+    if (trace.isEmpty()) {
+        qWarning() << "\nError! Trace is empty.";
+        return 1;
+    }
+
+    qDebug() << "Replaying" << trace.size() << "accesses of" << kind
+             << "trace against" << backend << "backend with capacity" << capacity << "...\n";
+
+    ReplayResult result;
+    result.hitNsecs.reserve(trace.size());
+    result.missNsecs.reserve(trace.size());
+
+    if (backend == "lru") {
+        replayLru(trace, capacity, result);
+    } else {
+        replayOrderedMap(trace, capacity, result);
+    }
+
+    double seconds = result.totalNsecs / 1e9;
+    qDebug() << "Total :" << result.totalNsecs / 1000000 << "msecs";
+    qDebug() << "Throughput :" << qint64(trace.size() / (seconds > 0 ? seconds : 1e-9)) << "ops/sec";
+    qDebug() << "Hit ratio :" << double(result.hits) / trace.size()
+             << "(" << result.hits << "hits," << result.misses << "misses )";
+    // Latencies include the cost of reading the clock around every access
+    qDebug() << "Hit latency : p50" << percentile(result.hitNsecs, 0.50)
+             << "nsecs, p99" << percentile(result.hitNsecs, 0.99) << "nsecs";
+    qDebug() << "Miss latency : p50" << percentile(result.missNsecs, 0.50)
+             << "nsecs, p99" << percentile(result.missNsecs, 0.99) << "nsecs";
+    qDebug() << "\n";
+
+    return 0;
+}
@@ -0,0 +1,17 @@
+QT -= gui
+
+greaterThan(QT_MAJOR_VERSION, 4) {
+CONFIG += c++11
+}
+
+SOURCES = \
+    main.cpp
+
+INCLUDEPATH += $$PWD/../../examples/lrucache
+
+# Qt 6 needs C++17
+greaterThan(QT_MAJOR_VERSION, 5) {
+CONFIG += c++17
+}
+
+include (../../src/src.pri)